@@ -514,5 +514,7 @@ SEXP do_untracemem(SEXP, SEXP, SEXP, SEXP);
 
 SEXP do_idlemark(SEXP, SEXP, SEXP, SEXP);
 SEXP do_getchildfile(SEXP call, SEXP op, SEXP args, SEXP rho);
+SEXP do_timeRbins(SEXP, SEXP, SEXP, SEXP);
+SEXP do_timeRreset(SEXP, SEXP, SEXP, SEXP);
 
 #endif /* not R_INTERNAL_H */
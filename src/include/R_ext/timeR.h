@@ -0,0 +1,55 @@
+/*
+ *  timeR : Deterministic profiling for R
+ *  Copyright (C) 2013  TU Dortmund Informatik LS XII
+ *
+ *  This header file is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ */
+
+/*
+  Named timers for native code of packages, usable from the main
+  thread and from helper threads, e.g. of OpenMP or pthreads.
+
+  A helper thread calls timeR_thread_begin() before its first timer
+  and timeR_thread_end() before it exits; the timers of threads that
+  are still running when R exits are included with the calls they
+  finished. Timer IDs are only valid in the thread that asked for
+  them:
+
+      unsigned int t = timeR_thread_timer("mypkg:fit_block");
+      timeR_thread_start(t);
+      ...
+      timeR_thread_stop(t);
+
+  This header is only installed by R built with timeR.
+*/
+
+#ifndef R_EXT_TIMER_H_
+#define R_EXT_TIMER_H_
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+int          timeR_thread_begin(void);
+void         timeR_thread_end(void);
+unsigned int timeR_thread_timer(const char *name);
+void         timeR_thread_start(unsigned int timer);
+void         timeR_thread_stop(unsigned int timer);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* R_EXT_TIMER_H_ */
@@ -67,6 +67,7 @@ typedef struct {
     int         numArgs;
 
     R_NativePrimitiveArgType *types;   
+    unsigned int timeR_bin;  /* timeR bin of this routine, 0 until first call */
 } Rf_DotCSymbol;
 
 typedef Rf_DotCSymbol Rf_DotFortranSymbol;
@@ -76,6 +77,7 @@ typedef struct {
     char       *name;
     DL_FUNC     fun;
     int         numArgs;
+    unsigned int timeR_bin;  /* timeR bin of this routine, 0 until first call */
 } Rf_DotCallSymbol;
 
 typedef Rf_DotCallSymbol Rf_DotExternalSymbol;
@@ -190,7 +192,7 @@ DL_FUNC R_dlsym(DllInfo *info, char const *name,
   SEXP R_MakeExternalPtrFn(DL_FUNC p, SEXP tag, SEXP prot);
   DL_FUNC R_ExternalPtrAddrFn(SEXP s);
 */
-DL_FUNC R_dotCallFn(SEXP, SEXP, int);
-SEXP R_doDotCall(DL_FUNC, int, SEXP *, SEXP);
+DL_FUNC R_dotCallFn(SEXP, SEXP, int, R_RegisteredNativeSymbol *);
+SEXP R_doDotCall(DL_FUNC, int, SEXP *, SEXP, R_RegisteredNativeSymbol *);
 
 #endif /* ifdef R_DYNPRIV_H */
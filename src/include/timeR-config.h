@@ -22,20 +22,62 @@
 #ifndef TIME_R_CONFIG_H
 #define TIME_R_CONFIG_H
 
-/* number of timers allocated per block */
-#define TIME_R_MBLOCK_SIZE    10000
+/* maximum number of nested timers, the address space for this many */
+/* timers is reserved at startup and committed by the OS on first use */
+#define TIME_R_STACK_ENTRIES  (1 << 24)
 
-/* maximum number of timer blocks allocated */
-#define TIME_R_MAX_MBLOCKS    100
+/* maximum number of nested timers in a helper thread, see */
+/* timeR_thread_begin                                      */
+#define TIME_R_THREAD_STACK_ENTRIES (1 << 16)
+
+/* nesting depth of the deep overhead test */
+#define TIME_R_OVERHEAD_DEPTH 50000
 
 /* number additional bins allocated initially */
 /* (~690 for R_FunTab)                        */
 #define TIME_R_INITIAL_EMPTY_BINS 750
 
-/* number of bins allocated at once when all existing are in use */
+/* minimum number of bins allocated at once when all existing are in */
+/* use, otherwise the number of bins grows by half                     */
 #define TIME_R_REALLOC_BINS 100
 
-/* initial/increment size of external function map */
-#define TIME_R_EXTFUNC_MAP_STEP 100
+/* initial size of the map of user function bins, must be a power of */
+/* two                                                                */
+#define TIME_R_BIN_MAP_INITIAL 1024
+
+/* initial size of external function map, must be a power of two */
+#define TIME_R_EXTFUNC_MAP_INITIAL 256
+
+/* initial and default maximum number of call tree nodes */
+#define TIME_R_CALLTREE_INITIAL_NODES 1024
+#define TIME_R_CALLTREE_MAX_NODES     100000
+
+/* number of events per binary trace chunk and number of chunks in */
+/* the ring buffer between the interpreter and the writer thread   */
+#define TIME_R_TRACE_CHUNK_EVENTS 65536
+#define TIME_R_TRACE_CHUNKS       8
+
+/* histogram sub-buckets per power of two (as log2), determines the */
+/* relative resolution of the percentiles (3 -> 1/8)                */
+#define TIME_R_HIST_SUBBITS 3
+
+/* maximum number of performance counters per run */
+#define TIME_R_MAX_COUNTERS 4
+
+/* maximum number of byte-code instructions, must be at least OPCOUNT */
+/* in eval.c                                                          */
+#define TIME_R_MAX_BCOPS 128
+
+/* maximum number of garbage collection levels, must be larger than */
+/* NUM_OLD_GENERATIONS in memory.c                                  */
+#define TIME_R_MAX_GC_LEVELS 8
+
+/* shared memory reserved for the results of forked children, */
+/* only the pages written by children are committed           */
+#define TIME_R_CHILD_SHM_SIZE ((size_t)1 << 30)
+
+/* maximum number of forked children that write their results to a */
+/* file when the shared memory is full, and are still merged        */
+#define TIME_R_MAX_CHILD_OVERFLOWS 1024
 
 #endif
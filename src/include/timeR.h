@@ -23,10 +23,12 @@
 #define TIME_R_H
 
 #define TIME_R_BIN_NAME_ATTR "timeR_bin_name"
+#define TIME_R_BINDING_ATTR  "timeR_binding"
 
 #ifdef HAVE_TIME_R
 
 #include <assert.h>
+#include <stdint.h>
 #include "timeR-config.h"
 
 # ifdef TIME_R_CLOCK_POSIX
@@ -57,20 +59,74 @@ typedef struct {
     timeR_t            sum_total;     /* time accumulated including "called" bins */
     unsigned long long starts;        /* number of times this bin started accumulating */
     unsigned long long aborts;        /* number of times this bin implicitly ended */
+    unsigned long long skipped;       /* starts not measured in sampling mode */
+    unsigned int       sample_countdown; /* starts to skip before the next measurement */
     unsigned int       bcode:1;       /* a user function was evaluated in byte-compiled form */
+    unsigned int       anon:1;        /* named after its position, see timeR_anonfunc_bin */
+    unsigned int       successor;     /* named bin that replaced this one, see timeR_rename_bin */
+    unsigned int      *hist;          /* call duration histogram, see timeR_hist_record */
+    timeR_t            max;           /* longest call, only kept with histograms */
+    uint64_t           nodes_self;    /* nodes allocated in just this bin */
+    uint64_t           nodes_total;   /* nodes allocated including "called" bins */
+    uint64_t           bytes_self;    /* vector bytes allocated in just this bin */
+    uint64_t           bytes_total;   /* vector bytes allocated including "called" bins */
+    uint64_t          *counters;      /* self and total of each performance counter */
+    uint64_t           nested_self;   /* timers started directly inside this bin */
+    uint64_t           nested_total;  /* timers started at any depth inside this bin */
+    uint64_t           wall_ns;       /* wall time of blocking calls, see BEGIN_IO_TIMER */
+    uint64_t           cpu_ns;        /* thread CPU time of blocking calls */
+    const char        *srcfile;       /* R source file of the bin, NULL if unknown */
+    unsigned int       srcline;       /* line in srcfile */
+    unsigned int       srccol;        /* column in srcfile */
 } tr_bin_t;
 
+#define TR_HIST_SUB     (1 << TIME_R_HIST_SUBBITS)
+#define TR_HIST_BUCKETS (64 * TR_HIST_SUB)
+
 /* timer element: instanced for each time timer */
 typedef struct {
     timeR_t      start;        /* start time of this timer */
     timeR_t      lower_sum;    /* time accumulated in "called" timers */
     unsigned int bin_id;       /* ID of the bin that receives the timer */
+    unsigned int parent_node;  /* call tree node that was active before this timer */
 } tr_timer_t;
 
+/* allocation counters of a timer, kept parallel to the timer stack */
+typedef struct {
+    uint64_t     nodes_start;  /* timeR_alloc_nodes when the timer started */
+    uint64_t     bytes_start;  /* timeR_alloc_bytes when the timer started */
+    uint64_t     nodes_lower;  /* nodes allocated in "called" timers */
+    uint64_t     bytes_lower;  /* bytes allocated in "called" timers */
+} tr_alloc_t;
+
+/* nested timer counts of a timer, kept parallel to the timer stack */
+typedef struct {
+    uint64_t     starts_start; /* timeR_nested_starts when the timer started */
+    uint64_t     starts_lower; /* timers started at any depth in "called" timers */
+} tr_nested_t;
+
+/* call tree node: accumulates times of a bin in one calling context */
+typedef struct {
+    unsigned int       parent;        /* node of the calling context */
+    unsigned int       bin_id;        /* bin measured in this context */
+    timeR_t            sum_self;      /* time accumulated in just this node */
+    timeR_t            sum_total;     /* time accumulated including child nodes */
+    unsigned long long starts;        /* number of times this node was entered */
+} tr_ctnode_t;
+
+/* binary trace event, see timeR_trace_event */
+typedef struct {
+    uint32_t     word;         /* event type in the upper 2 bits, bin ID below */
+    uint32_t     delta;        /* time since the previous event */
+} tr_event_t;
+
+#define TR_TRACE_ENTER   0
+#define TR_TRACE_EXIT    1
+#define TR_TRACE_DELTAHI 3     /* upper 32 bits of the next event's delta */
+
 /* pointer to timer element */
 typedef struct {
-    tr_timer_t   *curblock;       /* timer block that holds this element */
-    unsigned int  index;          /* index within that block */
+    tr_timer_t   *timer;          /* element on the measurement stack */
 } tr_measureptr_t;
 
 void timeR_init_early(void);
@@ -79,22 +135,127 @@ void timeR_finish(void);
 
 void timeR_forked(long childpid);
 
+/* the measurement state is per thread, so native code in helper     */
+/* threads can use timers after timeR_thread_begin; initial-exec keeps */
+/* the accesses as cheap as those of a global                         */
+#define TIME_R_TLS __thread __attribute__((tls_model("initial-exec")))
+
 /* exposed internal state for the fast path inlines */
-extern tr_timer_t  *timeR_measureblocks[TIME_R_MAX_MBLOCKS];
-extern tr_timer_t  *timeR_current_mblock;
-extern unsigned int timeR_current_mblockidx;
-extern unsigned int timeR_next_mindex;
-extern tr_bin_t    *timeR_bins;
-extern timeR_t      timeR_current_lower_sum;
+extern TIME_R_TLS tr_timer_t  *timeR_stack;        /* bottom of the timer stack, NULL until set up */
+extern TIME_R_TLS tr_timer_t  *timeR_stack_top;    /* next free timer element */
+extern TIME_R_TLS tr_timer_t  *timeR_stack_limit;  /* end of the reserved stack region */
+extern TIME_R_TLS tr_bin_t    *timeR_bins;         /* bins of the main thread or of a helper thread */
+extern TIME_R_TLS timeR_t      timeR_current_lower_sum;
+
+/* run-time timer selection, see timeR_select_timers */
+extern char         timeR_static_enabled[TR_StaticBinCount];
+extern int          timeR_funtab_enabled;
+extern int          timeR_userfunc_enabled;
+extern int          timeR_extfunc_enabled;
+extern long         timeR_sample_rate;
+extern int          timeR_histograms;
+extern int          timeR_line_bins;
+
+/* the optional features below are per thread as well and are only */
+/* set up for the main thread, helper threads see them as disabled   */
+
+/* binary trace state */
+extern TIME_R_TLS int          timeR_trace_enabled;
+extern TIME_R_TLS tr_event_t  *timeR_trace_next;
+extern TIME_R_TLS tr_event_t  *timeR_trace_limit;
+extern TIME_R_TLS timeR_t      timeR_trace_last;
+
+/* allocation accounting, timeR_alloc_stack is NULL if it is disabled */
+extern TIME_R_TLS uint64_t     timeR_alloc_nodes;  /* nodes allocated since startup */
+extern TIME_R_TLS uint64_t     timeR_alloc_bytes;  /* vector bytes allocated since startup */
+extern TIME_R_TLS uint64_t     timeR_alloc_lower_nodes;
+extern TIME_R_TLS uint64_t     timeR_alloc_lower_bytes;
+extern TIME_R_TLS tr_alloc_t  *timeR_alloc_stack;
+
+/* overhead compensation, timeR_nested_stack is NULL if it is disabled */
+extern TIME_R_TLS uint64_t     timeR_nested_starts; /* timers started since startup */
+extern TIME_R_TLS uint64_t     timeR_nested_lower;
+extern TIME_R_TLS tr_nested_t *timeR_nested_stack;
+
+/* number of performance counters, 0 if they are disabled */
+extern TIME_R_TLS unsigned int timeR_counter_count;
+
+/* call tree state, timeR_ctnodes is NULL if the call tree is disabled */
+extern TIME_R_TLS tr_ctnode_t *timeR_ctnodes;
+extern TIME_R_TLS unsigned int timeR_current_ctnode;
+
+/* byte-code instruction timing, the extra last slot collects the time */
+/* outside of the byte-code interpreter                                */
+#define TR_BCOP_NONE TIME_R_MAX_BCOPS
+extern int                timeR_bcops_enabled;
+extern unsigned int       timeR_bcop_current;  /* instruction that runs now */
+extern timeR_t            timeR_bcop_start;    /* when it started */
+extern timeR_t            timeR_bcop_self[TIME_R_MAX_BCOPS + 1];
+extern unsigned long long timeR_bcop_count[TIME_R_MAX_BCOPS + 1];
 
 /* slow path functions for the fast path inlines */
-void timeR_measureblock_full(void);
+tr_measureptr_t timeR_stack_full(void);
 void timeR_end_timers_slowpath(const tr_measureptr_t *mptr, timeR_t when);
+void timeR_calltree_enter(tr_timer_t *m, unsigned int bin_id);
+void timeR_trace_slowpath(unsigned int type, unsigned int bin_id, timeR_t delta);
+void timeR_hist_alloc(tr_bin_t *bin);
+void timeR_counters_enter(tr_timer_t *m);
+void timeR_counters_exit(tr_timer_t *m, tr_bin_t *bin);
 
 /* debug aid */
 void timeR_dump_timer_stack(void);
 
 /* fast path implementation */
+
+/* charge the time since the last switch to the running instruction */
+/* and continue with op                                             */
+static inline void timeR_bcop_switch(unsigned int op) {
+    timeR_t now = tr_now();
+
+    timeR_bcop_self[timeR_bcop_current] += now - timeR_bcop_start;
+    timeR_bcop_current = op;
+    timeR_bcop_start   = now;
+}
+
+/* append an event to the binary trace */
+static inline void timeR_trace_event(unsigned int type, unsigned int bin_id,
+                                     timeR_t when) {
+    timeR_t delta = when - timeR_trace_last;
+
+    timeR_trace_last = when;
+    if (timeR_trace_next >= timeR_trace_limit ||
+        delta < 0 || delta > UINT32_MAX) {
+        timeR_trace_slowpath(type, bin_id, delta);
+        return;
+    }
+
+    timeR_trace_next->word  = (type << 30) | bin_id;
+    timeR_trace_next->delta = (uint32_t)delta;
+    timeR_trace_next++;
+}
+
+/* log-linear histogram bucket of a duration: values below TR_HIST_SUB */
+/* get a bucket each, above that every power of two is split into     */
+/* TR_HIST_SUB buckets                                                 */
+static inline unsigned int timeR_hist_bucket(timeR_t value) {
+    if (value < TR_HIST_SUB)
+        return value < 0 ? 0 : (unsigned int)value;
+
+    unsigned int msb   = 63 - __builtin_clzll((unsigned long long)value);
+    unsigned int shift = msb - TIME_R_HIST_SUBBITS;
+
+    return (shift + 1) * TR_HIST_SUB + ((value >> shift) & (TR_HIST_SUB - 1));
+}
+
+static inline void timeR_hist_record(tr_bin_t *bin, timeR_t value) {
+    if (bin->hist == NULL)
+        timeR_hist_alloc(bin);
+
+    bin->hist[timeR_hist_bucket(value)]++;
+    if (value > bin->max)
+        bin->max = value;
+}
+
 static inline tr_measureptr_t timeR_begin_timer(tr_bin_id_t timer) {
     timeR_t         start = tr_now();
     tr_timer_t      *m;
@@ -102,21 +263,50 @@ static inline tr_measureptr_t timeR_begin_timer(tr_bin_id_t timer) {
 
     //assert(timer < next_bin);
 
-    /* allocate the next free measurement */
-    mptr.curblock = timeR_current_mblock;
-    mptr.index    = timeR_next_mindex;
+    /* check if the reserved stack region is exhausted, also true in */
+    /* threads without measurement state, where both are NULL        */
+    if (timeR_stack_top >= timeR_stack_limit)
+        return timeR_stack_full();
 
-    timeR_current_mblock[timeR_next_mindex].lower_sum    = timeR_current_lower_sum;
-    timeR_current_lower_sum                              = 0;
+    /* allocate the next free measurement */
+    m          = timeR_stack_top++;
+    mptr.timer = m;
 
-    /* check if the measurement block is full */
-    if (++timeR_next_mindex >= TIME_R_MBLOCK_SIZE)
-        timeR_measureblock_full();
+    m->lower_sum            = timeR_current_lower_sum;
+    timeR_current_lower_sum = 0;
 
-    m         = &mptr.curblock[mptr.index];
     m->start  = start;
     m->bin_id = timer;
     timeR_bins[timer].starts++;
+
+    if (timeR_alloc_stack != NULL) {
+        tr_alloc_t *a = &timeR_alloc_stack[m - timeR_stack];
+
+        a->nodes_start = timeR_alloc_nodes;
+        a->bytes_start = timeR_alloc_bytes;
+        a->nodes_lower = timeR_alloc_lower_nodes;
+        a->bytes_lower = timeR_alloc_lower_bytes;
+        timeR_alloc_lower_nodes = 0;
+        timeR_alloc_lower_bytes = 0;
+    }
+
+    if (timeR_nested_stack != NULL) {
+        tr_nested_t *n = &timeR_nested_stack[m - timeR_stack];
+
+        n->starts_start = timeR_nested_starts++;
+        n->starts_lower = timeR_nested_lower;
+        timeR_nested_lower = 0;
+    }
+
+    if (timeR_counter_count != 0)
+        timeR_counters_enter(m);
+
+    if (timeR_ctnodes != NULL)
+        timeR_calltree_enter(m, timer);
+
+    if (timeR_trace_enabled)
+        timeR_trace_event(TR_TRACE_ENTER, timer, start);
+
     return mptr;
 }
 
@@ -125,19 +315,10 @@ static inline tr_measureptr_t timeR_begin_timer(tr_bin_id_t timer) {
 static inline void TMR_ALWAYS_INLINE timeR_end_latest_timer(timeR_t endtime) {
     tr_timer_t *m;
     tr_bin_t   *bin;
-    timeR_t     diff;
-
-    if (timeR_next_mindex == 0) {
-        /* go back one mblock */
-        assert(timeR_current_mblockidx > 0);
-        timeR_next_mindex = TIME_R_MBLOCK_SIZE - 1;
-        timeR_current_mblockidx--;
-        timeR_current_mblock = timeR_measureblocks[timeR_current_mblockidx];
-    } else
-        timeR_next_mindex--;
-
-    /* calculate time difference */
-    m    = &timeR_current_mblock[timeR_next_mindex];
+    timeR_t     diff, self = 0;
+
+    /* pop the newest timer */
+    m    = --timeR_stack_top;
     diff = endtime - m->start;
 
     //assert(m->bin_id < next_bin);
@@ -147,14 +328,58 @@ static inline void TMR_ALWAYS_INLINE timeR_end_latest_timer(timeR_t endtime) {
     /* calculate final amount of time spent in lower-level timers */
     if (diff >= timeR_current_lower_sum) {
         /* don't add negative values to self time */
-        bin->sum_self += diff - timeR_current_lower_sum;
+        self = diff - timeR_current_lower_sum;
+        bin->sum_self += self;
     } else {
         fprintf(stderr, "*** WARNING: Negative self time!\n");
     }
     timeR_current_lower_sum = m->lower_sum + diff;
+
+    if (timeR_histograms)
+        timeR_hist_record(bin, diff);
+
+    if (timeR_alloc_stack != NULL) {
+        tr_alloc_t *a     = &timeR_alloc_stack[m - timeR_stack];
+        uint64_t    nodes = timeR_alloc_nodes - a->nodes_start;
+        uint64_t    bytes = timeR_alloc_bytes - a->bytes_start;
+
+        bin->nodes_total += nodes;
+        bin->bytes_total += bytes;
+        bin->nodes_self  += nodes - timeR_alloc_lower_nodes;
+        bin->bytes_self  += bytes - timeR_alloc_lower_bytes;
+        timeR_alloc_lower_nodes = a->nodes_lower + nodes;
+        timeR_alloc_lower_bytes = a->bytes_lower + bytes;
+    }
+
+    if (timeR_nested_stack != NULL) {
+        tr_nested_t *n      = &timeR_nested_stack[m - timeR_stack];
+        uint64_t     nested = timeR_nested_starts - n->starts_start - 1;
+
+        bin->nested_total += nested;
+        bin->nested_self  += nested - timeR_nested_lower;
+        timeR_nested_lower = n->starts_lower + nested;
+    }
+
+    if (timeR_counter_count != 0)
+        timeR_counters_exit(m, bin);
+
+    if (timeR_ctnodes != NULL) {
+        tr_ctnode_t *node = &timeR_ctnodes[timeR_current_ctnode];
+
+        node->sum_self  += self;
+        node->sum_total += diff;
+        timeR_current_ctnode = m->parent_node;
+    }
+
+    if (timeR_trace_enabled)
+        timeR_trace_event(TR_TRACE_EXIT, m->bin_id, endtime);
 }
 
 static inline void timeR_end_timer(const tr_measureptr_t *mptr) {
+    /* not measured, see timeR_stack_full */
+    if (mptr->timer == NULL)
+        return;
+
     /* capture current time in case multiple timers are ending */
     timeR_t endtime = tr_now();
 
@@ -162,26 +387,55 @@ static inline void timeR_end_timer(const tr_measureptr_t *mptr) {
     timeR_end_latest_timer(endtime);
 
     /* run slowpath if this wasn't enough */
-    if (timeR_current_mblock != mptr->curblock ||
-        timeR_next_mindex    != mptr->index) {
-        timeR_bins[timeR_current_mblock[timeR_next_mindex].bin_id].aborts++;
+    if (timeR_stack_top != mptr->timer) {
+        timeR_bins[timeR_stack_top->bin_id].aborts++;
         timeR_end_timers_slowpath(mptr, endtime);
     }
 }
 
-tr_measureptr_t timeR_begin_external(char *name, void *addr);
+tr_measureptr_t timeR_begin_external(const char *name, void *addr,
+                                     unsigned int *cache);
+
+/* start the timer of an external function, the bin of registered  */
+/* routines is cached in their symbol info after the first lookup    */
+static inline tr_measureptr_t timeR_begin_external_cached(const char *name,
+                                                          void *addr,
+                                                          unsigned int *cache) {
+    if (cache != NULL && *cache != 0)
+        return timeR_begin_timer(*cache);
+
+    return timeR_begin_external(name, addr, cache);
+}
 
 /* generate a marker for the current position of the measurement stack */
 /* to avoid a branch this marker points to the next free measurement   */
 static inline tr_measureptr_t timeR_mark(void) {
     tr_measureptr_t mptr;
 
-    mptr.curblock = timeR_current_mblock;
-    mptr.index    = timeR_next_mindex;
+    mptr.timer = timeR_stack_top;
 
     return mptr;
 }
 
+/* sampling mode: check if this start of a function table or user   */
+/* function bin should be measured, counts the skipped starts if not */
+static inline int timeR_sample(unsigned int bin_id) {
+    tr_bin_t *bin;
+
+    if (timeR_sample_rate <= 1)
+        return 1;
+
+    bin = &timeR_bins[bin_id];
+    if (bin->sample_countdown == 0) {
+        bin->sample_countdown = timeR_sample_rate - 1;
+        return 1;
+    }
+
+    bin->sample_countdown--;
+    bin->skipped++;
+    return 0;
+}
+
 /* set the bcode flag in a time bin */
 static inline void timeR_mark_bcode(unsigned int bin_id) {
     timeR_bins[bin_id].bcode = 1;
@@ -189,12 +443,52 @@ static inline void timeR_mark_bcode(unsigned int bin_id) {
 
 unsigned int timeR_add_userfn_bin(void);
 void         timeR_name_bin(unsigned int bin_id, const char *name);
-void         timeR_name_bin_anonfunc(unsigned int bin_id, const char *file,
-                                     unsigned int line, unsigned int pos);
-void         timeR_release(tr_measureptr_t *marker);
+unsigned int timeR_userfn_bin(const char *file, unsigned int line,
+                              unsigned int pos, const char *name);
+unsigned int timeR_anonfunc_bin(const char *file, unsigned int line,
+                                unsigned int pos);
+unsigned int timeR_rename_bin(unsigned int bin_id, const char *name);
+unsigned int timeR_line_bin(const char *file, unsigned int line);
+void         timeR_bcops_setup(const char * const *names, unsigned int count);
+void         timeR_release(tr_measureptr_t *marker, unsigned int bcop);
+int          timeR_select_timers(const char *list, int state);
+void         timeR_calltree_setup(void);
+void         timeR_trace_setup(void);
+void         timeR_alloc_setup(void);
+void         timeR_compensate_setup(void);
+int          timeR_counters_setup(const char *list);
+
+/* allocation counting for memory.c */
+#  define TIMER_COUNT_NODE()       (timeR_alloc_nodes++)
+#  define TIMER_COUNT_BYTES(bytes) (timeR_alloc_bytes += (bytes))
+
+/* timers for native code in helper threads, see R_ext/timeR.h */
+int          timeR_thread_begin(void);
+void         timeR_thread_end(void);
+unsigned int timeR_thread_timer(const char *name);
+void         timeR_thread_start(unsigned int timer);
+void         timeR_thread_stop(unsigned int timer);
+
+/* wall and thread CPU time at the start of a timer that may block */
+typedef struct {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+} tr_cputime_t;
+
+void         timeR_cpu_begin(tr_cputime_t *start);
+void         timeR_cpu_end(unsigned int bin_id, const tr_cputime_t *start);
+
+/* statistics of one garbage collection, called by memory.c */
+void         timeR_gc_collected(unsigned int level, uint64_t nodes_marked,
+				uint64_t nodes_freed, uint64_t bytes_freed);
 
 void         timeR_idlemark(int state);
 void         timeR_getchildfile(char *buffer);
+void         timeR_reset_all(void);
+#ifdef R_INTERNALS_H_
+SEXP         timeR_bins_dataframe(void);
+void         timeR_name_closure(SEXP sym, SEXP fun, SEXP env);
+#endif
 
 static inline const char *timeR_get_bin_name(unsigned int bin_id) {
   return timeR_bins[bin_id].name;
@@ -202,9 +496,13 @@ static inline const char *timeR_get_bin_name(unsigned int bin_id) {
 
 extern char *timeR_output_file;
 extern int   timeR_output_raw;
+extern int   timeR_output_json;
 extern int   timeR_reduced_output;
 extern int   timeR_exclude_init;
 extern long  timeR_scale;
+extern char *timeR_calltree_file;
+extern unsigned int timeR_calltree_max;
+extern char *timeR_trace_file;
 
 /* convenience macros */
 #  define TimeR_CONCAT(a,b) a ## b
@@ -214,68 +512,129 @@ extern long  timeR_scale;
 //       and the unconditional version wasn't a C statement either
 #    define BEGIN_TIMER(bin) \
     tr_measureptr_t rtm_mptr_##bin; \
-    if (TimeR_CONCAT(bin, _State)) \
+    const int rtm_on_##bin = TimeR_CONCAT(bin, _State) && \
+	timeR_static_enabled[bin]; \
+    if (rtm_on_##bin) \
 	rtm_mptr_##bin = timeR_begin_timer(bin)
 
 #    define END_TIMER(bin) \
-    if (TimeR_CONCAT(bin, _State)) \
+    if (TimeR_CONCAT(bin, _State) && rtm_on_##bin) \
 	timeR_end_timer(&rtm_mptr_##bin)
 
+// static timers of calls that may wait for I/O or other processes,
+// which also measure wall and thread CPU time with clock_gettime()
+#    define BEGIN_IO_TIMER(bin) \
+    BEGIN_TIMER(bin); \
+    tr_cputime_t rtm_cpu_##bin; \
+    if (TimeR_CONCAT(bin, _State) && rtm_on_##bin) \
+	timeR_cpu_begin(&rtm_cpu_##bin)
+
+#    define END_IO_TIMER(bin) \
+    if (TimeR_CONCAT(bin, _State) && rtm_on_##bin) \
+	timeR_cpu_end(bin, &rtm_cpu_##bin); \
+    END_TIMER(bin)
+
 #    define BEGIN_TIMER_ALTERNATIVES(cond, bin_true, bin_false)	\
     tr_measureptr_t rtm_mptr_##bin_true;			\
+    int rtm_on_##bin_true = 0;					\
     if (cond) {							\
-	if (TimeR_CONCAT(bin_true, _State))			\
+	if (TimeR_CONCAT(bin_true, _State) &&			\
+	    timeR_static_enabled[bin_true]) {			\
+	    rtm_on_##bin_true = 1;				\
 	    rtm_mptr_##bin_true = timeR_begin_timer(bin_true);	\
+	}							\
     } else {							\
-	if (TimeR_CONCAT(bin_false, _State))			\
+	if (TimeR_CONCAT(bin_false, _State) &&			\
+	    timeR_static_enabled[bin_false]) {			\
+	    rtm_on_##bin_true = 1;				\
 	    rtm_mptr_##bin_true = timeR_begin_timer(bin_false); \
+	}							\
     }
 
 #    define END_TIMER_ALTERNATIVES(cond, bin_true, bin_false)	\
-    if (cond && TimeR_CONCAT(bin_true, _State)) {		\
-	timeR_end_timer(&rtm_mptr_##bin_true);			\
-    } else if (!cond && TimeR_CONCAT(bin_false, _State)) {	\
-	timeR_end_timer(&rtm_mptr_##bin_true);			\
-    }
+    if (rtm_on_##bin_true)					\
+	timeR_end_timer(&rtm_mptr_##bin_true)
 
 #  else
 #    define BEGIN_TIMER(bin)                     do {} while (0)
 #    define END_TIMER(bin)                       do {} while (0)
+#    define BEGIN_IO_TIMER(bin)                  do {} while (0)
+#    define END_IO_TIMER(bin)                    do {} while (0)
 #    define BEGIN_TIMER_ALTERNATIVES(cond,tr,fa) do {} while (0)
 #    define END_TIMER_ALTERNATIVES(cond,tr,fa)   do {} while (0)
 #  endif
 
+/* a jump out of bcEval skips RELEASE_BCOP_TIMER, so the instruction */
+/* running at the mark is restored as well                           */
 #  define MARK_TIMER() \
-    tr_measureptr_t rtm_mptr_marker = timeR_mark()
+    tr_measureptr_t rtm_mptr_marker = timeR_mark(); \
+    const unsigned int rtm_bcop_marker = timeR_bcop_current
 
 #  define RELEASE_TIMER() \
-    timeR_release(&rtm_mptr_marker)
+    timeR_release(&rtm_mptr_marker, rtm_bcop_marker)
 
 
 /* timers for external functions */
 #  ifdef TIME_R_EXTFUNC
 
-#    define BEGIN_EXTERNAL_TIMER(fname, faddr)			\
-    tr_measureptr_t rtm_mptr_extfunc =				\
-	timeR_begin_external(fname, faddr);
+#    define BEGIN_EXTERNAL_TIMER_CACHED(fname, faddr, cache)	\
+    tr_measureptr_t rtm_mptr_extfunc;				\
+    const int rtm_on_extfunc = timeR_extfunc_enabled;		\
+    if (rtm_on_extfunc)						\
+	rtm_mptr_extfunc = timeR_begin_external_cached(fname, faddr, cache);
+
+#    define BEGIN_EXTERNAL_TIMER(fname, faddr)	\
+    BEGIN_EXTERNAL_TIMER_CACHED(fname, faddr, NULL)
 
 #    define END_EXTERNAL_TIMER()		\
-    timeR_end_timer(&rtm_mptr_extfunc);
+    if (rtm_on_extfunc)				\
+	timeR_end_timer(&rtm_mptr_extfunc);
 
 #  else
 #    define BEGIN_EXTERNAL_TIMER(n,a) do {} while (0)
+#    define BEGIN_EXTERNAL_TIMER_CACHED(n,a,c) do {} while (0)
 #    define END_EXTERNAL_TIMER()      do {} while (0)
 #  endif
 
 
+/* timers for byte-code instructions, eval.c only starts them when */
+/* threaded code is used                                           */
+#  ifdef TIME_R_BCOPS
+
+#    define BEGIN_BCOP_TIMER(op) \
+    if (timeR_bcops_enabled) { \
+	timeR_bcop_count[op]++; \
+	timeR_bcop_switch(op); \
+    }
+
+/* a nested bcEval returns to the instruction that called it */
+#    define MARK_BCOP_TIMER() \
+    const unsigned int rtm_bcop_caller = timeR_bcop_current
+
+#    define RELEASE_BCOP_TIMER() \
+    if (timeR_bcops_enabled) \
+	timeR_bcop_switch(rtm_bcop_caller)
+
+#  else
+#    define BEGIN_BCOP_TIMER(op)  do {} while (0)
+#    define MARK_BCOP_TIMER()     do {} while (0)
+#    define RELEASE_BCOP_TIMER()  do {} while (0)
+#  endif
+
+
 /* timers for functions called via R_FunTab */
 #  ifdef TIME_R_FUNTAB
 
 #    define BEGIN_PRIMFUN_TIMER(id) \
-    tr_measureptr_t rtm_mptr_primfun = timeR_begin_timer((id) + TR_StaticBinCount)
+    tr_measureptr_t rtm_mptr_primfun; \
+    const int rtm_on_primfun = timeR_funtab_enabled && \
+	timeR_sample((id) + TR_StaticBinCount); \
+    if (rtm_on_primfun) \
+	rtm_mptr_primfun = timeR_begin_timer((id) + TR_StaticBinCount)
 
 #    define END_PRIMFUN_TIMER(id) \
-    timeR_end_timer(&rtm_mptr_primfun)
+    if (rtm_on_primfun) \
+	timeR_end_timer(&rtm_mptr_primfun)
 
 #  else
 
@@ -289,15 +648,34 @@ extern long  timeR_scale;
 #  ifdef TIME_R_USERFUNCTIONS
 
 #    define BEGIN_RFUNC_TIMER(id) \
-    tr_measureptr_t rtm_mptr_rfunction = timeR_begin_timer(id)
+    tr_measureptr_t rtm_mptr_rfunction; \
+    const int rtm_on_rfunction = timeR_userfunc_enabled && \
+	timeR_sample(id); \
+    if (rtm_on_rfunction) \
+	rtm_mptr_rfunction = timeR_begin_timer(id)
 
 #    define END_RFUNC_TIMER(id) \
-    timeR_end_timer(&rtm_mptr_rfunction)
+    if (rtm_on_rfunction) \
+	timeR_end_timer(&rtm_mptr_rfunction)
+
+/* statements, id is 0 for statements without a line bin */
+#    define BEGIN_LINE_TIMER(id) \
+    tr_measureptr_t rtm_mptr_line; \
+    const int rtm_on_line = (id) != 0 && timeR_userfunc_enabled && \
+	timeR_sample(id); \
+    if (rtm_on_line) \
+	rtm_mptr_line = timeR_begin_timer(id)
+
+#    define END_LINE_TIMER() \
+    if (rtm_on_line) \
+	timeR_end_timer(&rtm_mptr_line)
 
 #  else
 
 #    define BEGIN_RFUNC_TIMER(id) do {} while (0)
 #    define END_RFUNC_TIMER(id)   do {} while (0)
+#    define BEGIN_LINE_TIMER(id)  do {} while (0)
+#    define END_LINE_TIMER()      do {} while (0)
 
 #  endif
 
@@ -306,6 +684,8 @@ extern long  timeR_scale;
   // timeR not enabled in configure
 #  define TIME_R_ENABLED 0
 
+#include <stdint.h>
+
 static inline void timeR_init_early(void)   {}
 static inline void timeR_startup_done(void) {}
 static inline void timeR_finish(void)       {}
@@ -317,10 +697,33 @@ static inline unsigned int timeR_add_userfn_bin(void) {
 }
 
 static inline void timeR_name_bin(unsigned int bin_id, const char *name) {}
-static inline void timeR_name_bin_anonfunc(unsigned int bin_id,
-					   const char *file,
-					   unsigned int line,
-					   unsigned int pos) {}
+
+static inline unsigned int timeR_userfn_bin(const char *file,
+					    unsigned int line,
+					    unsigned int pos,
+					    const char *name) {
+    return 0;
+}
+
+static inline unsigned int timeR_anonfunc_bin(const char *file,
+					      unsigned int line,
+					      unsigned int pos) {
+    return 0;
+}
+
+static inline unsigned int timeR_rename_bin(unsigned int bin_id,
+					    const char *name) {
+    return bin_id;
+}
+
+static inline unsigned int timeR_line_bin(const char *file,
+					  unsigned int line) {
+    return 0;
+}
+
+#ifdef R_INTERNALS_H_
+static inline void timeR_name_closure(SEXP sym, SEXP fun, SEXP env) {}
+#endif
 
 static inline const char * timeR_get_bin_name(unsigned int bin_id) {
   return "";
@@ -330,17 +733,32 @@ static inline void timeR_mark_bcode(unsigned int bin_id) {}
 
 static inline void timeR_idlemark(int state) {}
 
-  // avoids an #ifdef in eval.c
+static inline void timeR_gc_collected(unsigned int level, uint64_t nodes_marked,
+				      uint64_t nodes_freed, uint64_t bytes_freed) {}
+
+  // avoid an #ifdef in eval.c and gram.y
 #  define TR_UserFuncFallback 0
+#  define timeR_line_bins     0
+
+#  define TIMER_COUNT_NODE()       do {} while (0)
+#  define TIMER_COUNT_BYTES(bytes) do {} while (0)
 
   // defined as macros to ensure the parameter is not parsed
 #  define BEGIN_TIMER(unused)     do {} while (0)
 #  define END_TIMER(unused)       do {} while (0)
+#  define BEGIN_IO_TIMER(unused)  do {} while (0)
+#  define END_IO_TIMER(unused)    do {} while (0)
 #  define BEGIN_PRIMFUN_TIMER(id) do {} while (0)
 #  define END_PRIMFUN_TIMER(id)   do {} while (0)
 #  define BEGIN_RFUNC_TIMER(id)   do {} while (0)
 #  define END_RFUNC_TIMER(id)     do {} while (0)
+#  define BEGIN_LINE_TIMER(id)    do {} while (0)
+#  define END_LINE_TIMER()        do {} while (0)
+#  define BEGIN_BCOP_TIMER(op)    do {} while (0)
+#  define MARK_BCOP_TIMER()       do {} while (0)
+#  define RELEASE_BCOP_TIMER()    do {} while (0)
 #  define BEGIN_EXTERNAL_TIMER(n,a) do {} while (0)
+#  define BEGIN_EXTERNAL_TIMER_CACHED(n,a,c) do {} while (0)
 #  define END_EXTERNAL_TIMER()    do {} while (0)
 
 #endif // HAVE_TIME_R
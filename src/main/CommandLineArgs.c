@@ -254,10 +254,133 @@ R_common_command_line(int *pac, char **argv, Rstart Rp)
 		timeR_reduced_output = 0;
 	    }
 
+	    else if(strncmp(*av, "--timeR-histograms", 18) == 0) {
+		timeR_histograms = 1;
+	    }
+
+	    else if(strncmp(*av, "--timeR-lines", 13) == 0) {
+		timeR_line_bins = 1;
+	    }
+
+	    else if(strncmp(*av, "--timeR-memory", 14) == 0) {
+		timeR_alloc_setup();
+	    }
+
+	    else if(strncmp(*av, "--timeR-compensate", 18) == 0) {
+		timeR_compensate_setup();
+	    }
+
+	    else if(strncmp(*av, "--timeR-counters", 16) == 0) {
+		p = strchr(*av, '=');
+		if (p == NULL) {
+		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
+		} else p++;
+		if (p == NULL || *p == 0) {
+		    snprintf(msg, 1024,
+		             _("WARNING: no value given for '%s'"), *av);
+		    R_ShowMessage(msg);
+		    break;
+		}
+		timeR_counters_setup(p);
+	    }
+
 	    else if (strncmp(*av, "--timeR-exclude-init", 20) == 0) {
 		timeR_exclude_init = 1;
 	    }
 
+	    else if(strncmp(*av, "--timeR-enable", 14) == 0 ||
+		    strncmp(*av, "--timeR-disable", 15) == 0) {
+		int state = strncmp(*av, "--timeR-enable", 14) == 0;
+		p = strchr(*av, '=');
+		if (p == NULL) {
+		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
+		} else p++;
+		if (p == NULL || *p == 0) {
+		    snprintf(msg, 1024,
+		             _("WARNING: no value given for '%s'"), *av);
+		    R_ShowMessage(msg);
+		    break;
+		}
+
+		timeR_select_timers(p, state);
+	    }
+
+	    else if(strncmp(*av, "--timeR-sample", 14) == 0) {
+		p = strchr(*av, '=');
+		if (p == NULL) {
+		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
+		} else p++;
+		if (p == NULL || *p == 0) {
+		    snprintf(msg, 1024,
+		             _("WARNING: no value given for '%s'"), *av);
+		    R_ShowMessage(msg);
+		    break;
+		}
+
+		lval = strtol(p, &p, 10);
+		if (lval < 1)
+		    R_ShowMessage(_("WARNING: '--timeR-sample' value is too small: ignored"));
+		else if (lval > INT_MAX)
+		    R_ShowMessage(_("WARNING: '--timeR-sample' value is too large: ignored"));
+		else timeR_sample_rate = lval;
+	    }
+
+	    else if(strncmp(*av, "--timeR-calltree-nodes", 22) == 0) {
+		p = strchr(*av, '=');
+		if (p == NULL) {
+		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
+		} else p++;
+		if (p == NULL || *p == 0) {
+		    snprintf(msg, 1024,
+		             _("WARNING: no value given for '%s'"), *av);
+		    R_ShowMessage(msg);
+		    break;
+		}
+
+		lval = strtol(p, &p, 10);
+		if (lval < 2)
+		    R_ShowMessage(_("WARNING: '--timeR-calltree-nodes' value is too small: ignored"));
+		else if (lval > INT_MAX)
+		    R_ShowMessage(_("WARNING: '--timeR-calltree-nodes' value is too large: ignored"));
+		else timeR_calltree_max = lval;
+	    }
+
+	    else if(strncmp(*av, "--timeR-calltree", 16) == 0) {
+		p = strchr(*av, '=');
+		if (p == NULL) {
+		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
+		} else p++;
+		if (p == NULL || *p == 0) {
+		    snprintf(msg, 1024,
+		             _("WARNING: no value given for '%s'"), *av);
+		    R_ShowMessage(msg);
+		    break;
+		}
+		if(timeR_calltree_file != NULL)
+		    free(timeR_calltree_file);
+		timeR_calltree_file = strdup(p);
+		timeR_calltree_setup();
+	    }
+
+	    else if(strncmp(*av, "--timeR-trace", 13) == 0) {
+		p = strchr(*av, '=');
+		if (p == NULL) {
+		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
+		} else p++;
+		if (p == NULL || *p == 0) {
+		    snprintf(msg, 1024,
+		             _("WARNING: no value given for '%s'"), *av);
+		    R_ShowMessage(msg);
+		    break;
+		}
+		if(timeR_trace_file != NULL) {
+		    R_ShowMessage(_("WARNING: multiple timeR trace files specified, using first"));
+		} else {
+		    timeR_trace_file = strdup(p);
+		    timeR_trace_setup();
+		}
+	    }
+
 	    else if(strncmp(*av, "--timeR-scale", 13) == 0) {
 		p = strchr(*av, '=');
 		if (p == NULL) {
@@ -280,7 +403,12 @@ R_common_command_line(int *pac, char **argv, Rstart Rp)
 
 	    else if(strncmp(*av, "--timeR-file", 12) == 0 ||
 		    strncmp(*av, "--timeR-raw",  11) == 0 ||
+		    strncmp(*av, "--timeR-json", 12) == 0 ||
 		    (strncmp(*av, "--time", 6) == 0 && (*av)[6] != 'R')) {
+		/* check the option before av moves on to a separate value */
+		timeR_output_raw  = strncmp(*av, "--timeR-raw",  11) == 0;
+		timeR_output_json = strncmp(*av, "--timeR-json", 12) == 0;
+
 		p = strchr(*av, '=');
 		if (p == NULL) {
 		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
@@ -296,12 +424,6 @@ R_common_command_line(int *pac, char **argv, Rstart Rp)
 		    free(timeR_output_file);
 		}
 		timeR_output_file = strdup(p);
-
-		if (strncmp(*av, "--timeR-raw", 11) == 0)
-		    timeR_output_raw = 1;
-		else
-		    timeR_output_raw = 0;
-
 	    }
 #endif
 	    else { /* unknown -option */
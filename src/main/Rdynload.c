@@ -373,6 +373,7 @@ R_addFortranRoutine(DllInfo *info,
     sym->name = strdup(croutine->name);
     sym->fun = croutine->fun;
     sym->numArgs = croutine->numArgs > -1 ? croutine->numArgs : -1;
+    sym->timeR_bin = 0;
     if(croutine->types)
 	R_setPrimitiveArgTypes(croutine, sym);
 }
@@ -385,6 +386,7 @@ R_addExternalRoutine(DllInfo *info,
     sym->name = strdup(croutine->name);
     sym->fun = croutine->fun;
     sym->numArgs = croutine->numArgs > -1 ? croutine->numArgs : -1;
+    sym->timeR_bin = 0;
 }
 
 static void
@@ -394,6 +396,7 @@ R_addCRoutine(DllInfo *info, const R_CMethodDef * const croutine,
     sym->name = strdup(croutine->name);
     sym->fun = croutine->fun;
     sym->numArgs = croutine->numArgs > -1 ? croutine->numArgs : -1;
+    sym->timeR_bin = 0;
     if(croutine->types)
 	R_setPrimitiveArgTypes(croutine, sym);
 }
@@ -405,6 +408,7 @@ R_addCallRoutine(DllInfo *info, const R_CallMethodDef * const croutine,
     sym->name = strdup(croutine->name);
     sym->fun = croutine->fun;
     sym->numArgs = croutine->numArgs > -1 ? croutine->numArgs : -1;
+    sym->timeR_bin = 0;
 }
 
 static void
@@ -32,6 +32,8 @@
 
 #include <R_ext/RS.h> /* for Memzero */
 
+#include "timeR.h"
+
 attribute_hidden
 R_xlen_t asVecSize(SEXP x)
 {
@@ -122,6 +124,9 @@ SEXP attribute_hidden do_makelazy(SEXP call, SEXP op, SEXP args, SEXP rho)
 	PROTECT(val = eval(VECTOR_ELT(values, i), eenv));
 	PROTECT(expr0 = duplicate(expr));
 	SETCAR(CDR(expr0), val);
+	/* lets lazyLoadDBfetch name the timeR bin of a closure */
+	if (TIME_R_ENABLED)
+	    setAttrib(expr0, install(TIME_R_BINDING_ATTR), name);
 	defineVar(name, mkPROMISE(expr0, eenv), aenv);
 	UNPROTECT(2);
     }
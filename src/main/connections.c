@@ -83,6 +83,7 @@
 #include <R_ext/RS.h>		/* R_chk_calloc and Free */
 #include <R_ext/Riconv.h>
 #include <R_ext/Print.h> // REprintf, REvprintf
+#include "timeR.h"
 #undef ERROR			/* for compilation on Windows */
 
 #ifdef Win32
@@ -749,13 +750,17 @@ static size_t file_read(void *ptr, size_t size, size_t nitems,
 {
     Rfileconn this = con->private;
     FILE *fp = this->fp;
+    size_t res;
 
+    BEGIN_IO_TIMER(TR_fileRead);
     if(this->last_was_write) {
 	this->wpos = f_tell(this->fp);
 	this->last_was_write = FALSE;
 	f_seek(this->fp, this->rpos, SEEK_SET);
     }
-    return fread(ptr, size, nitems, fp);
+    res = fread(ptr, size, nitems, fp);
+    END_IO_TIMER(TR_fileRead);
+    return res;
 }
 
 static size_t file_write(const void *ptr, size_t size, size_t nitems,
@@ -1531,7 +1536,10 @@ static size_t gzfile_read(void *ptr, size_t size, size_t nitems,
     /* uses 'unsigned' for len */
     if ((double) size * (double) nitems > UINT_MAX)
 	error(_("too large a block specified"));
-    return R_gzread(fp, ptr, (unsigned int)(size*nitems))/size;
+    BEGIN_IO_TIMER(TR_gzfileRead);
+    size_t res = R_gzread(fp, ptr, (unsigned int)(size*nitems))/size;
+    END_IO_TIMER(TR_gzfileRead);
+    return res;
 }
 
 static size_t gzfile_write(const void *ptr, size_t size, size_t nitems,
@@ -177,10 +177,10 @@ checkValidSymbolId(SEXP op, SEXP call, DL_FUNC *fun,
 }
 
 attribute_hidden
-DL_FUNC R_dotCallFn(SEXP op, SEXP call, int nargs) {
-    R_RegisteredNativeSymbol symbol = {R_CALL_SYM, {NULL}, NULL};
+DL_FUNC R_dotCallFn(SEXP op, SEXP call, int nargs,
+		    R_RegisteredNativeSymbol *symbol) {
     DL_FUNC fun = NULL;
-    checkValidSymbolId(op, call, &fun, &symbol, NULL);
+    checkValidSymbolId(op, call, &fun, symbol, NULL);
     /* should check arg count here as well */
     return fun;
 }
@@ -545,14 +545,18 @@ SEXP attribute_hidden do_External(SEXP call, SEXP op, SEXP args, SEXP env)
     if (PRIMVAL(op) == 1) {
 	R_ExternalRoutine2 fun = (R_ExternalRoutine2) ofun;
 	BEGIN_TIMER(TR_dotExternal);
-	BEGIN_EXTERNAL_TIMER(buf, ofun);
+	BEGIN_EXTERNAL_TIMER_CACHED(buf, ofun,
+				    symbol.symbol.external ?
+				    &symbol.symbol.external->timeR_bin : NULL);
 	retval = fun(call, op, args, env);
 	END_EXTERNAL_TIMER();
 	END_TIMER(TR_dotExternal);
     } else {
 	R_ExternalRoutine fun = (R_ExternalRoutine) ofun;
 	BEGIN_TIMER(TR_dotExternal);
-	BEGIN_EXTERNAL_TIMER(buf, ofun);
+	BEGIN_EXTERNAL_TIMER_CACHED(buf, ofun,
+				    symbol.symbol.external ?
+				    &symbol.symbol.external->timeR_bin : NULL);
 	retval = fun(args);
 	END_EXTERNAL_TIMER();
 	END_TIMER(TR_dotExternal);
@@ -568,13 +572,15 @@ typedef SEXP (*VarFun)(...);
 typedef DL_FUNC VarFun;
 #endif
 
-SEXP attribute_hidden R_doDotCall(DL_FUNC ofun, int nargs, SEXP *cargs,
-				  SEXP call) {
+/* name and tr_bin (the cached timeR bin of a registered routine) may */
+/* be NULL for routines that were not registered                       */
+static SEXP doDotCall(DL_FUNC ofun, int nargs, SEXP *cargs, SEXP call,
+		      const char *name, unsigned int *tr_bin) {
     BEGIN_TIMER(TR_RdoDotCall);
     VarFun fun = NULL;
     SEXP retval = R_NilValue;	/* -Wall */
     fun = (VarFun) ofun;
-    BEGIN_EXTERNAL_TIMER(buf, ofun);
+    BEGIN_EXTERNAL_TIMER_CACHED(name, ofun, tr_bin);
     switch (nargs) {
     case 0:
 	retval = (SEXP)ofun();
@@ -1233,6 +1239,15 @@ SEXP attribute_hidden R_doDotCall(DL_FUNC ofun, int nargs, SEXP *cargs,
     return retval;
 }
 
+/* symbol is filled in by R_dotCallFn for registered routines */
+SEXP attribute_hidden R_doDotCall(DL_FUNC ofun, int nargs, SEXP *cargs,
+				  SEXP call, R_RegisteredNativeSymbol *symbol) {
+    Rf_DotCallSymbol *info = symbol->symbol.call;
+
+    return doDotCall(ofun, nargs, cargs, call,
+		     info ? info->name : NULL, info ? &info->timeR_bin : NULL);
+}
+
 /* .Call(name, <args>) */
 SEXP attribute_hidden do_dotcall(SEXP call, SEXP op, SEXP args, SEXP env)
 {
@@ -1264,14 +1279,17 @@ SEXP attribute_hidden do_dotcall(SEXP call, SEXP op, SEXP args, SEXP env)
 		      nargs, symbol.symbol.call->numArgs, buf);
     }
 
+    unsigned int *tr_bin =
+	symbol.symbol.call ? &symbol.symbol.call->timeR_bin : NULL;
+
     if (R_check_constants < 4)
-	retval = R_doDotCall(ofun, nargs, cargs, call);
+	retval = doDotCall(ofun, nargs, cargs, call, buf, tr_bin);
     else {
 	SEXP *cargscp = (SEXP *) R_alloc(nargs, sizeof(SEXP));
 	int i;
 	for(i = 0; i < nargs; i++)
 	    cargscp[i] = PROTECT(duplicate(cargs[i]));
-	retval = PROTECT(R_doDotCall(ofun, nargs, cargs, call));
+	retval = PROTECT(doDotCall(ofun, nargs, cargs, call, buf, tr_bin));
 	Rboolean constsOK = TRUE;
 	for(i = 0; constsOK && i < nargs; i++)
 	    /* 39: not numerical comparison, not single NA, not attributes as
@@ -1753,7 +1771,8 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
     }
 
     BEGIN_TIMER_ALTERNATIVES(Fort, TR_dotFortran, TR_dotC);
-    BEGIN_EXTERNAL_TIMER(symName, ofun);
+    BEGIN_EXTERNAL_TIMER_CACHED(symName, ofun,
+				symbol.symbol.c ? &symbol.symbol.c->timeR_bin : NULL);
 
     switch (nargs) {
     case 0:
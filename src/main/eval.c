@@ -939,6 +939,11 @@ void attribute_hidden R_init_jit_enabled(void)
     char *enable = getenv("R_ENABLE_JIT");
     if (enable != NULL)
 	val = atoi(enable);
+#ifdef HAVE_TIME_R
+    /* statement timers only exist in the AST interpreter */
+    if (timeR_line_bins)
+	val = 0;
+#endif
     if (val) {
 	loadCompilerNamespace();
 	checkCompilerOptions(val);
@@ -2216,6 +2221,19 @@ SEXP attribute_hidden do_paren(SEXP call, SEXP op, SEXP args, SEXP rho)
     return CAR(args);
 }
 
+/* timeR bin of a statement, see timeR_line_bin */
+static R_INLINE unsigned int srcrefLineBin(SEXP srcref)
+{
+    /* srcrefs loaded from code saved under --timeR-lines keep their */
+    /* bins, only time statements while line timing is enabled      */
+    if (timeR_line_bins          &&
+	TYPEOF(srcref) == INTSXP &&
+	LENGTH(srcref) > 8)
+	return INTEGER(srcref)[8];
+
+    return 0;
+}
+
 SEXP attribute_hidden do_begin(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP s = R_NilValue;
@@ -2229,7 +2247,9 @@ SEXP attribute_hidden do_begin(SEXP call, SEXP op, SEXP args, SEXP rho)
 		PrintValue(CAR(args));
 		do_browser(call, op, R_NilValue, rho);
 	    }
+	    BEGIN_LINE_TIMER(srcrefLineBin(R_Srcref));
 	    s = eval(CAR(args), rho);
+	    END_LINE_TIMER();
 	    UNPROTECT(1);
 	    args = CDR(args);
 	}
@@ -2627,6 +2647,8 @@ SEXP attribute_hidden do_set(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    setVar(lhs, rhs, ENCLOS(rho));
 	else                                        /* <-, = */
 	    defineVar(lhs, rhs, rho);
+	if (TIME_R_ENABLED && TYPEOF(rhs) == CLOSXP)
+	    timeR_name_closure(lhs, rhs, PRIMVAL(op) == 2 ? R_EmptyEnv : rho);
 	R_Visible = FALSE;
 	return rhs;
     case LANGSXP:
@@ -3541,6 +3563,10 @@ static SEXP R_ConstantsRegistry = NULL;
 # define THREADED_CODE
 #endif
 
+#if defined(THREADED_CODE) && defined(TIME_R_BCOPS)
+static void setup_bcop_timers(void);
+#endif
+
 attribute_hidden
 void R_initialize_bcode(void)
 {
@@ -3573,6 +3599,9 @@ void R_initialize_bcode(void)
 
 #ifdef THREADED_CODE
   bcEval(NULL, NULL, FALSE);
+#  ifdef TIME_R_BCOPS
+  setup_bcop_timers();
+#  endif
 #endif
 
   /* the first constants record always stays in place for protection */
@@ -4365,12 +4394,14 @@ static R_INLINE double (*getMath1Fun(int i, SEXP call))(double) {
 #define DO_DOTCALL() do {						\
 	SEXP call = VECTOR_ELT(constants, GETOP());			\
 	int nargs = GETOP();						\
-	DL_FUNC ofun = R_dotCallFn(GETSTACK(- nargs - 1), call, nargs);	\
+	R_RegisteredNativeSymbol symbol = {R_CALL_SYM, {NULL}, NULL};	\
+	DL_FUNC ofun = R_dotCallFn(GETSTACK(- nargs - 1), call, nargs,	\
+				   &symbol);				\
 	if (ofun && nargs <= DOTCALL_MAX) {				\
 	    SEXP cargs[DOTCALL_MAX];					\
 	    for (int i = 0; i < nargs; i++)				\
 		cargs[i] = GETSTACK(i - nargs);				\
-	    SEXP val = R_doDotCall(ofun, nargs, cargs, call);		\
+	    SEXP val = R_doDotCall(ofun, nargs, cargs, call, &symbol);	\
 	    R_BCNodeStackTop -= nargs;					\
 	    SETSTACK(-1, val);						\
 	    NEXT();							\
@@ -4596,12 +4627,33 @@ typedef union { void *v; int i; } BCODE;
 volatile
 static struct { void *addr; int argc; char *instname; } opinfo[OPCOUNT];
 
+#ifdef TIME_R_BCOPS
+/* pass the instruction names filled in by bcEval to timeR */
+static void setup_bcop_timers(void)
+{
+    const char *names[OPCOUNT];
+    for (int i = 0; i < OPCOUNT; i++)
+	names[i] = opinfo[i].instname;
+    timeR_bcops_setup(names, OPCOUNT);
+}
+
+/* the timer is started between the dispatch target and the code, the */
+/* negative case label is never matched and only takes the colon       */
+#define OP(name,n) \
+  case name##_OP: opinfo[name##_OP].addr = (__extension__ &&op_##name); \
+    opinfo[name##_OP].argc = (n); \
+    opinfo[name##_OP].instname = #name; \
+    goto loop; \
+    op_##name: BEGIN_BCOP_TIMER(name##_OP); \
+    case -1 - name##_OP
+#else
 #define OP(name,n) \
   case name##_OP: opinfo[name##_OP].addr = (__extension__ &&op_##name); \
     opinfo[name##_OP].argc = (n); \
     opinfo[name##_OP].instname = #name; \
     goto loop; \
     op_##name
+#endif
 
 #define BEGIN_MACHINE  NEXT(); init: { loop: switch(which++)
 #define LASTOP } retvalue = R_NilValue; goto done
@@ -5919,6 +5971,7 @@ Rboolean attribute_hidden R_BCVersionOK(SEXP s)
 static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 {
   BEGIN_TIMER(TR_bcEval);
+  MARK_BCOP_TIMER();
 
   SEXP retvalue = R_NilValue, constants;
   BCODE *pc, *codebase;
@@ -7001,6 +7054,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 #ifdef BC_PROFILING
   current_opcode = old_current_opcode;
 #endif
+  RELEASE_BCOP_TIMER();
   END_TIMER(TR_bcEval);
   return retvalue;
 }
@@ -177,6 +177,7 @@ static SEXP	TagArg(SEXP, SEXP, YYLTYPE *);
 static int 	processLineDirective();
 static void	setParseFilename(SEXP);
 static const char* getSrcFileName(SEXP);
+static const char* getSrcfileFilename(SEXP);
 
 /* These routines allocate constants */
 
@@ -583,6 +584,19 @@ static SEXP makeSrcref(YYLTYPE *lloc, SEXP srcfile, unsigned int bin_index)
     return val;
 }
 
+/* srcref of a statement in a braced expression list, carries a timeR */
+/* bin in slot 8 if statement timing is enabled                       */
+static SEXP makeStatementSrcref(YYLTYPE *lloc)
+{
+    unsigned int bin_index = 0;
+
+    if (timeR_line_bins)
+	bin_index = timeR_line_bin(getSrcfileFilename(ParseState.SrcFile),
+				   lloc->first_line);
+
+    return makeSrcref(lloc, ParseState.SrcFile, bin_index);
+}
+
 static SEXP attachSrcrefs(SEXP val)
 {
     SEXP srval;
@@ -702,7 +716,7 @@ static SEXP xxexprlist1(SEXP expr, YYLTYPE *lloc)
 	PROTECT(tmp = NewList());
 	if (ParseState.keepSrcRefs) {
 	    setAttrib(tmp, R_SrcrefSymbol, SrcRefs);
-	    REPROTECT(SrcRefs = list1(makeSrcref(lloc, ParseState.SrcFile, 0)), srindex);
+	    REPROTECT(SrcRefs = list1(makeStatementSrcref(lloc)), srindex);
 	}
 	PROTECT(ans = GrowList(tmp, expr));
 	UNPROTECT_PTR(tmp);
@@ -718,7 +732,7 @@ static SEXP xxexprlist2(SEXP exprlist, SEXP expr, YYLTYPE *lloc)
     SEXP ans;
     if (GenerateCode) {
 	if (ParseState.keepSrcRefs)
-	    REPROTECT(SrcRefs = listAppend(SrcRefs, list1(makeSrcref(lloc, ParseState.SrcFile, 0))), srindex);
+	    REPROTECT(SrcRefs = listAppend(SrcRefs, list1(makeStatementSrcref(lloc))), srindex);
 	PROTECT(ans = GrowList(exprlist, expr));
     }
     else
@@ -958,14 +972,11 @@ static SEXP xxdefun(SEXP fname, SEXP formals, SEXP body, YYLTYPE *lloc)
     	if (ParseState.keepSrcRefs) {
 	    unsigned int bin_index;
 
-	    bin_index = timeR_add_userfn_bin();
+	    bin_index = timeR_anonfunc_bin(getSrcfileFilename(ParseState.SrcFile),
+					   lloc->first_line,
+					   lloc->first_column);
 	    srcref = makeSrcref(lloc, ParseState.SrcFile, bin_index);
     	    ParseState.didAttach = TRUE;
-
-	    timeR_name_bin_anonfunc(INTEGER(srcref)[8],
-				    getSrcFileName(srcref),
-				    lloc->first_line,
-				    lloc->first_column);
     	} else
     	    srcref = R_NilValue;
 	PROTECT(ans = lang4(fname, CDR(formals), body, srcref));
@@ -1026,7 +1037,7 @@ static SEXP xxassign(SEXP n1, SEXP n2, SEXP n3)
 		snprintf(nametmp, sizeof(nametmp), "%s:%s", getSrcFileName(srcref),
 			 CHAR(PRINTNAME(n2)));
 
-		timeR_name_bin(INTEGER(srcref)[8], nametmp);
+		INTEGER(srcref)[8] = timeR_rename_bin(INTEGER(srcref)[8], nametmp);
 	    }
 	}
     }
@@ -2768,8 +2779,12 @@ static int processLineDirective(int *type)
 
 /* return the source file name from srcref as a C string */
 static const char *getSrcFileName(SEXP srcref) {
+    return getSrcfileFilename(getAttrib(srcref, R_SrcfileSymbol));
+}
+
+/* return the file name of a srcfile environment as a C string */
+static const char *getSrcfileFilename(SEXP srcfile) {
     static SEXP filename_symbol;
-    SEXP srcfile = getAttrib(srcref, R_SrcfileSymbol);
 
     if (filename_symbol == NULL)
         filename_symbol = install("filename");
@@ -281,6 +281,21 @@ static SEXPREC UnmarkedNodeTemplate;
 #define LEVEL_1_FREQ 5
 static int collect_counts_max[] = { LEVEL_0_FREQ, LEVEL_1_FREQ };
 
+/* The frequencies can be set with R_GC_LEVEL_0_FREQ and
+   R_GC_LEVEL_1_FREQ.  With R_GC_ADAPTIVE set to a non-zero value, they
+   are adapted to the fraction of old nodes that survive a collection:
+   if more than R_StableSurvival of the nodes of the old generations
+   collected at level N > 0 survive, these generations hold mostly
+   long-lived data, and the number of level N - 1 collections before
+   the next level N one is doubled, up to R_MaxFreqFactor times the
+   set frequency.  If less than R_UnstableSurvival survive, it is
+   halved again, down to the set frequency. */
+static int collect_counts_base[] = { LEVEL_0_FREQ, LEVEL_1_FREQ };
+static Rboolean R_GCAdaptive = FALSE;
+static double R_StableSurvival = 0.9;
+static double R_UnstableSurvival = 0.5;
+static int R_MaxFreqFactor = 16;
+
 /* When a level N collection fails to produce at least MinFreeFrac *
    R_NSize free nodes and MinFreeFrac * R_VSize free vector space, the
    next collection will be a level N + 1 collection.
@@ -399,6 +414,27 @@ static void init_gc_grow_settings()
     }
 }
 
+static void init_gc_collect_settings(void)
+{
+    char *arg;
+
+    arg = getenv("R_GC_LEVEL_0_FREQ");
+    if (arg != NULL) {
+	int freq = atoi(arg);
+	if (1 <= freq && freq <= 10000)
+	    collect_counts_max[0] = collect_counts_base[0] = freq;
+    }
+    arg = getenv("R_GC_LEVEL_1_FREQ");
+    if (arg != NULL) {
+	int freq = atoi(arg);
+	if (1 <= freq && freq <= 10000)
+	    collect_counts_max[1] = collect_counts_base[1] = freq;
+    }
+    arg = getenv("R_GC_ADAPTIVE");
+    if (arg != NULL && atoi(arg) != 0)
+	R_GCAdaptive = TRUE;
+}
+
 /* Maximal Heap Limits.  These variables contain upper limits on the
    heap sizes.  They could be made adjustable from the R level,
    perhaps by a handler for a recoverable error.
@@ -497,6 +533,12 @@ static int num_old_gens_to_collect = 0;
 static int gen_gc_counts[NUM_OLD_GENERATIONS + 1];
 static int collect_counts[NUM_OLD_GENERATIONS];
 
+/* old nodes collected and surviving in level 1, 2, ... collections;
+   the survivors of all collected generations end up in the older
+   ones, so they are counted together */
+static double gen_old_collected[NUM_OLD_GENERATIONS];
+static double gen_old_survived[NUM_OLD_GENERATIONS];
+
 
 /* Node Pages.  Non-vector nodes and small vector nodes are allocated
    from fixed size pages.  The pages for each node class are kept in a
@@ -724,6 +766,7 @@ static R_size_t R_NodesInUse = 0;
   } \
   R_GenHeap[c].Free = NEXT_NODE(__n__); \
   R_NodesInUse++; \
+  TIMER_COUNT_NODE(); \
   (s) = __n__; \
 } while (0)
 
@@ -737,6 +780,7 @@ static R_size_t R_NodesInUse = 0;
 	    error("need new page - should not happen");	\
 	R_GenHeap[c].Free = NEXT_NODE(__n__);		\
 	R_NodesInUse++;					\
+	TIMER_COUNT_NODE();				\
 	(s) = __n__;					\
     } while (0)
 
@@ -863,6 +907,106 @@ static void DEBUG_RELEASE_PRINT(int rel_pages, int maxrel_pages, int i)
 
 /* Page Allocation and Release. */
 
+/* Huge page regions.  With R_GC_HUGE_PAGES set to a non-zero value,
+   the pages of small nodes are carved from regions of HUGE_REGION_SIZE
+   bytes that are aligned to their size and marked with
+   madvise(MADV_HUGEPAGE), so that the kernel can back them with
+   transparent huge pages and walking the heap needs far fewer TLB
+   entries.  Large vectors spanning several regions get the same
+   advice.  Regions are not returned to the system; released pages are
+   kept on a free list and reused first.  The kernel places memory on
+   the NUMA node of the thread that first touches it, which for the
+   node pages is the thread initializing them in GetNewPage. */
+
+#include <stdint.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+# define HUGE_PAGES
+#endif
+
+#define HUGE_REGION_SIZE ((uintptr_t) 2 * 1024 * 1024)
+#define HUGE_ALIGN 64
+
+static Rboolean gc_huge_pages = FALSE;  /* R_GC_HUGE_PAGES */
+static char *huge_next, *huge_end;      /* unused part of the current region */
+static PAGE_HEADER *huge_free_pages;    /* released pages */
+
+static void init_gc_huge_settings(void)
+{
+#ifdef HUGE_PAGES
+    char *arg = getenv("R_GC_HUGE_PAGES");
+    if (arg != NULL && atoi(arg) != 0)
+	gc_huge_pages = TRUE;
+#endif
+}
+
+#ifdef HUGE_PAGES
+/* map twice the size and unmap the parts outside the aligned region */
+static char *NewHugeRegion(void)
+{
+    char *map = mmap(NULL, 2 * HUGE_REGION_SIZE, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+	return NULL;
+
+    uintptr_t start = ((uintptr_t) map + HUGE_REGION_SIZE - 1) &
+	~(HUGE_REGION_SIZE - 1);
+    uintptr_t end = start + HUGE_REGION_SIZE;
+    if (start > (uintptr_t) map)
+	munmap(map, start - (uintptr_t) map);
+    if ((uintptr_t) map + 2 * HUGE_REGION_SIZE > end)
+	munmap((void *) end, (uintptr_t) map + 2 * HUGE_REGION_SIZE - end);
+    madvise((void *) start, HUGE_REGION_SIZE, MADV_HUGEPAGE);
+    return (char *) start;
+}
+
+/* advise huge pages for the aligned regions inside a large block */
+static void AdviseHugePages(void *mem, R_size_t size)
+{
+    uintptr_t start = ((uintptr_t) mem + HUGE_REGION_SIZE - 1) &
+	~(HUGE_REGION_SIZE - 1);
+    uintptr_t end = ((uintptr_t) mem + size) & ~(HUGE_REGION_SIZE - 1);
+
+    if (end > start)
+	madvise((void *) start, end - start, MADV_HUGEPAGE);
+}
+#else
+# define NewHugeRegion() NULL
+# define AdviseHugePages(mem, size) do { } while (0)
+#endif
+
+/* returns NULL if no memory is left, like malloc */
+static PAGE_HEADER *AllocHeapPage(void)
+{
+    const uintptr_t size = (R_PAGE_SIZE + HUGE_ALIGN - 1) & ~(HUGE_ALIGN - 1);
+    PAGE_HEADER *page;
+
+    if (!gc_huge_pages)
+	return malloc(R_PAGE_SIZE);
+
+    if (huge_free_pages != NULL) {
+	page = huge_free_pages;
+	huge_free_pages = page->next;
+	return page;
+    }
+    if (huge_next == NULL || (uintptr_t) (huge_end - huge_next) < size) {
+	char *region = NewHugeRegion();
+	if (region == NULL)
+	    return NULL;
+	huge_next = region;
+	huge_end = region + HUGE_REGION_SIZE;
+    }
+    page = (PAGE_HEADER *) huge_next;
+    huge_next += size;
+    return page;
+}
+
 static void GetNewPage(int node_class)
 {
     SEXP s, base;
@@ -873,10 +1017,10 @@ static void GetNewPage(int node_class)
     node_size = NODE_SIZE(node_class);
     page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
 
-    page = malloc(R_PAGE_SIZE);
+    page = AllocHeapPage();
     if (page == NULL) {
 	R_gc_full(0);
-	page = malloc(R_PAGE_SIZE);
+	page = AllocHeapPage();
 	if (page == NULL)
 	    mem_err_malloc((R_size_t) R_PAGE_SIZE);
     }
@@ -908,6 +1052,332 @@ static void GetNewPage(int node_class)
     }
 }
 
+/* Background freeing.  With R_GC_BACKGROUND_FREE set to a non-zero
+   value, the large vectors and the pages of small nodes released by a
+   collection are unlinked and accounted for as before, but handed to
+   a helper thread that returns them to the C library, so that the
+   mutator can continue while free(), and the munmap() behind it for
+   large blocks, runs.  The released blocks are chained through their
+   first word.  Blocks of custom allocators are always freed in the
+   main thread, as their free functions need not be thread-safe. */
+
+#ifndef Win32
+#if (defined(__APPLE__) || defined(_REENTRANT) || defined(HAVE_OPENMP)) && \
+     ! defined(HAVE_PTHREAD)
+# define HAVE_PTHREAD
+#endif
+#endif
+
+#ifdef HAVE_PTHREAD
+# define BACKGROUND_FREE
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#ifdef BACKGROUND_FREE
+static Rboolean gc_background_free = FALSE;   /* R_GC_BACKGROUND_FREE */
+static Rboolean free_thread_running = FALSE;
+static void *free_batch, **free_batch_tail;   /* released by this collection */
+
+/* shared with the free thread, protected by free_mutex */
+static pthread_mutex_t free_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t free_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t free_done_cond = PTHREAD_COND_INITIALIZER;
+static void *free_queue, **free_queue_tail;
+static Rboolean free_busy;
+
+static void init_gc_free_settings(void)
+{
+    char *arg = getenv("R_GC_BACKGROUND_FREE");
+    if (arg != NULL && atoi(arg) != 0)
+	gc_background_free = TRUE;
+}
+
+static void *FreeWorker(void *arg)
+{
+#ifdef HAVE_TIME_R
+    unsigned int timer = 0;
+    if (timeR_thread_begin() == 0)
+	timer = timeR_thread_timer("GCBackgroundFree");
+#endif
+
+    pthread_mutex_lock(&free_mutex);
+    for (;;) {
+	while (free_queue == NULL)
+	    pthread_cond_wait(&free_work_cond, &free_mutex);
+	void *block = free_queue;
+	free_queue = NULL;
+	free_busy = TRUE;
+	pthread_mutex_unlock(&free_mutex);
+
+#ifdef HAVE_TIME_R
+	if (timer) timeR_thread_start(timer);
+#endif
+	while (block != NULL) {
+	    void *next = *(void **) block;
+	    free(block);
+	    block = next;
+	}
+#ifdef HAVE_TIME_R
+	if (timer) timeR_thread_stop(timer);
+#endif
+
+	pthread_mutex_lock(&free_mutex);
+	if (free_queue == NULL) {
+	    free_busy = FALSE;
+	    pthread_cond_broadcast(&free_done_cond);
+	}
+    }
+    return NULL;
+}
+
+/* the free thread does not exist in a forked child; the blocks it had
+   taken are lost there, the queued ones are freed by a new thread */
+static void FreeAtForkChild(void)
+{
+    free_thread_running = FALSE;
+    free_busy = FALSE;
+    pthread_mutex_init(&free_mutex, NULL);
+    pthread_cond_init(&free_work_cond, NULL);
+    pthread_cond_init(&free_done_cond, NULL);
+}
+
+static Rboolean StartFreeThread(void)
+{
+    static Rboolean registered = FALSE;
+    pthread_t thread;
+    sigset_t all, old;
+    int res;
+
+    if (!registered) {
+	pthread_atfork(NULL, NULL, FreeAtForkChild);
+	registered = TRUE;
+    }
+
+    /* signals are handled by the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    res = pthread_create(&thread, NULL, FreeWorker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (res != 0) {
+	/* no warning(), which could allocate */
+	REprintf(_("the GC background free thread could not be started\n"));
+	gc_background_free = FALSE;
+	return FALSE;
+    }
+    pthread_detach(thread);
+    free_thread_running = TRUE;
+    return TRUE;
+}
+
+/* free a block now or after the collection */
+static R_INLINE void ReleaseBlock(void *block)
+{
+    if (gc_background_free) {
+	*(void **) block = NULL;
+	if (free_batch == NULL)
+	    free_batch = block;
+	else
+	    *free_batch_tail = block;
+	free_batch_tail = (void **) block;
+    }
+    else free(block);
+}
+
+/* pass the blocks released by a collection to the free thread */
+static void QueueReleasedBlocks(void)
+{
+    if (free_batch == NULL)
+	return;
+    if (!free_thread_running && !StartFreeThread()) {
+	while (free_batch != NULL) {
+	    void *next = *(void **) free_batch;
+	    free(free_batch);
+	    free_batch = next;
+	}
+	return;
+    }
+
+    pthread_mutex_lock(&free_mutex);
+    if (free_queue == NULL)
+	free_queue = free_batch;
+    else
+	*free_queue_tail = free_batch;
+    free_queue_tail = free_batch_tail;
+    pthread_cond_signal(&free_work_cond);
+    pthread_mutex_unlock(&free_mutex);
+    free_batch = NULL;
+}
+
+/* wait until all released blocks have been returned to the C library */
+static void WaitForReleasedBlocks(void)
+{
+    if (!free_thread_running)
+	return;
+    pthread_mutex_lock(&free_mutex);
+    while (free_queue != NULL || free_busy)
+	pthread_cond_wait(&free_done_cond, &free_mutex);
+    pthread_mutex_unlock(&free_mutex);
+}
+#else
+# define ReleaseBlock(block) free(block)
+# define QueueReleasedBlocks() do { } while (0)
+# define WaitForReleasedBlocks() do { } while (0)
+#endif
+
+/* Vector arena.  With R_GC_VECTOR_ARENA set to a non-zero value, the
+   large vectors of up to ARENA_MAX_BLOCK bytes are not allocated with
+   malloc, but taken from free lists of blocks of a few size classes,
+   four per power of two.  The blocks of a class are carved from slabs
+   of ARENA_SLAB_SIZE bytes and go back to the free list of their class
+   when the vector is released, so that repeatedly allocated vectors of
+   similar sizes reuse the same memory.  The size of a released vector
+   is computed like for R_LargeVallocSize, so its class need not be
+   stored.  Slabs are never freed; instead, the pages inside free
+   blocks that are not needed soon are returned to the system with
+   madvise() along with the empty pages of small nodes. */
+
+#define ARENA_MIN_SHIFT 7                       /* 128 bytes */
+#define ARENA_MAX_SHIFT 20                      /* 1 MB */
+#define ARENA_MAX_BLOCK ((R_size_t) 1 << ARENA_MAX_SHIFT)
+#define ARENA_CLASSES (4 * (ARENA_MAX_SHIFT - ARENA_MIN_SHIFT) + 1)
+#define ARENA_SLAB_SIZE (256 * 1024)
+#define ARENA_KEEP_FREE 2       /* blocks per class kept in memory */
+
+typedef struct arena_block_st {
+    struct arena_block_st *next;
+    int advised;                /* inner pages returned to the system */
+} arena_block_t;
+
+static Rboolean gc_vector_arena = FALSE;       /* R_GC_VECTOR_ARENA */
+static arena_block_t *arena_free[ARENA_CLASSES];
+
+static void init_gc_arena_settings(void)
+{
+    char *arg = getenv("R_GC_VECTOR_ARENA");
+    if (arg != NULL && atoi(arg) != 0)
+	gc_vector_arena = TRUE;
+}
+
+/* class c holds blocks of 2^k (1 + j/4) bytes, c = 4 (k - ARENA_MIN_SHIFT) + j */
+static R_INLINE R_size_t ArenaBlockSize(int c)
+{
+    return (R_size_t) (4 + c % 4) << (c / 4 + ARENA_MIN_SHIFT - 2);
+}
+
+/* the smallest class with blocks of at least bytes */
+static R_INLINE int ArenaClass(R_size_t bytes)
+{
+    int k = ARENA_MIN_SHIFT;
+
+    if (bytes <= ((R_size_t) 1 << ARENA_MIN_SHIFT))
+	return 0;
+    while (((bytes - 1) >> (k + 1)) != 0)
+	k++;
+    R_size_t quarter = (R_size_t) 1 << (k - 2);
+    return 4 * (k - ARENA_MIN_SHIFT) +
+	(int) ((bytes - ((R_size_t) 1 << k) + quarter - 1) / quarter);
+}
+
+/* returns NULL if no memory is left, like malloc */
+static void *ArenaAlloc(int c)
+{
+    arena_block_t *block = arena_free[c];
+
+    if (block == NULL) {
+	R_size_t size = ArenaBlockSize(c);
+	R_size_t count = size < ARENA_SLAB_SIZE ? ARENA_SLAB_SIZE / size : 1;
+	char *slab = malloc(count * size);
+
+	if (slab == NULL) {
+	    count = 1;
+	    slab = malloc(size);
+	    if (slab == NULL)
+		return NULL;
+	}
+	for (R_size_t i = count; i > 0; i--) {
+	    block = (arena_block_t *) (slab + (i - 1) * size);
+	    block->next = arena_free[c];
+	    arena_free[c] = block;
+	}
+    }
+    arena_free[c] = block->next;
+    return block;
+}
+
+static R_INLINE void ArenaRelease(void *mem, int c)
+{
+    arena_block_t *block = mem;
+
+    block->advised = FALSE;
+    block->next = arena_free[c];
+    arena_free[c] = block;
+}
+
+/* return the inner pages of the free blocks beyond the first few of
+   each class to the system, called from TryToReleasePages */
+static void ReleaseArenaPages(void)
+{
+#if defined(HAVE_MMAP) && defined(MADV_DONTNEED) && defined(HAVE_SYSCONF)
+    static uintptr_t page_size = 0;
+
+    if (!gc_vector_arena)
+	return;
+    if (page_size == 0)
+	page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+    for (int c = 0; c < ARENA_CLASSES; c++) {
+	R_size_t size = ArenaBlockSize(c);
+	if (size < 4 * page_size)
+	    continue;
+	arena_block_t *block = arena_free[c];
+	for (int i = 0; block != NULL; block = block->next, i++) {
+	    if (i < ARENA_KEEP_FREE || block->advised)
+		continue;
+	    uintptr_t start = (uintptr_t) (block + 1);
+	    uintptr_t end = (uintptr_t) block + size;
+	    start = (start + page_size - 1) & ~(page_size - 1);
+	    end &= ~(page_size - 1);
+	    if (end > start)
+		madvise((void *) start, end - start, MADV_DONTNEED);
+	    block->advised = TRUE;
+	}
+    }
+#endif
+}
+
+static R_INLINE void *AllocLargeVectorMem(R_size_t bytes)
+{
+    if (gc_vector_arena && bytes <= ARENA_MAX_BLOCK)
+	return ArenaAlloc(ArenaClass(bytes));
+
+    void *mem = malloc(bytes);
+    if (gc_huge_pages && mem != NULL && bytes >= 2 * HUGE_REGION_SIZE)
+	AdviseHugePages(mem, bytes);
+    return mem;
+}
+
+/* size is the length in VEC units as counted in R_LargeVallocSize */
+static R_INLINE void ReleaseLargeVectorMem(void *mem, R_size_t size)
+{
+    R_size_t bytes = sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC);
+
+    if (gc_vector_arena && bytes <= ARENA_MAX_BLOCK)
+	ArenaRelease(mem, ArenaClass(bytes));
+    else
+	ReleaseBlock(mem);
+}
+
+static R_INLINE void ReleaseHeapPage(PAGE_HEADER *page)
+{
+    if (gc_huge_pages) {
+	page->next = huge_free_pages;
+	huge_free_pages = page;
+    }
+    else ReleaseBlock(page);
+}
+
 static void ReleasePage(PAGE_HEADER *page, int node_class)
 {
     SEXP s;
@@ -924,7 +1394,7 @@ static void ReleasePage(PAGE_HEADER *page, int node_class)
 	R_GenHeap[node_class].AllocCount--;
     }
     R_GenHeap[node_class].PageCount--;
-    free(page);
+    ReleaseHeapPage(page);
 }
 
 static void TryToReleasePages(void)
@@ -933,6 +1403,7 @@ static void TryToReleasePages(void)
     int i;
     static int release_count = 0;
 
+    BEGIN_TIMER(TR_GCReleasePages);
     if (release_count == 0) {
 	release_count = R_PageReleaseFreq;
 	for (i = 0; i < NUM_SMALL_NODE_CLASSES; i++) {
@@ -977,8 +1448,10 @@ static void TryToReleasePages(void)
 	    DEBUG_RELEASE_PRINT(rel_pages, maxrel_pages, i);
 	    R_GenHeap[i].Free = NEXT_NODE(R_GenHeap[i].New);
 	}
+	ReleaseArenaPages();
     }
     else release_count--;
+    END_TIMER(TR_GCReleasePages);
 }
 
 /* compute size in VEC units so result will fit in LENGTH field for FREESXPs */
@@ -1042,11 +1515,11 @@ static void ReleaseLargeFreeVectors()
 		    R_LargeVallocSize -= size;
 #ifdef LONG_VECTOR_SUPPORT
 		    if (IS_LONG_VEC(s))
-			free(((char *) s) - sizeof(R_long_vec_hdr_t));
+			ReleaseBlock(((char *) s) - sizeof(R_long_vec_hdr_t));
 		    else
-			free(s);
+			ReleaseLargeVectorMem(s, size);
 #else
-		    free(s);
+		    ReleaseLargeVectorMem(s, size);
 #endif
 		} else {
 #ifdef LONG_VECTOR_SUPPORT
@@ -1522,12 +1995,343 @@ SEXP attribute_hidden do_regFinaliz(SEXP call, SEXP op, SEXP args, SEXP rho)
     } \
 } while (0)
 
+/* Parallel marking.  With R_GC_MARK_THREADS set to a number larger
+   than one, the main processing loop of full collections is run by
+   that many threads, the main thread being one of them.  Threads
+   only set mark bits while marking; a bit shares its word with the
+   other sxpinfo fields, so it is set with an atomic or.  Each thread
+   keeps the nodes it still has to scan on a mark stack of its own
+   and hands chunks of it to a shared pool when other threads ran out
+   of work.  The node lists are not touched while marking: the main
+   thread moves the marked nodes to their old generations afterwards
+   by walking the new space, which also contains the free nodes. */
+
+#if defined(HAVE_PTHREAD) && defined(__GNUC__)
+# define PARALLEL_MARK
+#endif
+
+#ifdef PARALLEL_MARK
+#define MAX_MARK_THREADS 256
+#define MARK_CHUNK 256
+
+typedef unsigned int __attribute__((__may_alias__)) sxpinfo_word_t;
+
+typedef struct {
+    SEXP *stack;
+    size_t top, max;
+    unsigned long phase;       /* last phase taken part in */
+} mark_thread_t;
+
+static int gc_mark_threads = 1;         /* R_GC_MARK_THREADS */
+static int mark_nthreads;               /* threads actually running */
+static mark_thread_t *mark_threads;     /* the main thread is the first */
+static sxpinfo_word_t mark_bit;         /* MARK_NODE in the sxpinfo word */
+
+/* shared by the marking threads, protected by mark_mutex */
+static pthread_mutex_t mark_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mark_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t mark_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t mark_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long mark_phase;        /* incremented to start marking */
+static int mark_idle;                   /* threads waiting for work, also read without lock */
+static int mark_active;                 /* helper threads still marking */
+static Rboolean mark_done;
+static SEXP *mark_pool;                 /* nodes handed out to idle threads */
+static size_t mark_pool_count, mark_pool_max;
+
+static void init_gc_mark_settings(void)
+{
+    char *arg = getenv("R_GC_MARK_THREADS");
+    if (arg != NULL) {
+	int n = atoi(arg);
+	if (1 <= n && n <= MAX_MARK_THREADS)
+	    gc_mark_threads = n;
+    }
+}
+
+/* R_Suicide is only safe in the main thread */
+static void mark_grow_failed(void)
+{
+    fprintf(stderr, "Fatal error: cannot grow the GC mark stack\n");
+    abort();
+}
+
+static R_INLINE void PushMarkStack(mark_thread_t *mt, SEXP s)
+{
+    if (mt->top == mt->max) {
+	size_t max = mt->max != 0 ? 2 * mt->max : 4 * MARK_CHUNK;
+	SEXP *stack = realloc(mt->stack, max * sizeof(SEXP));
+	if (stack == NULL)
+	    mark_grow_failed();
+	mt->stack = stack;
+	mt->max = max;
+    }
+    mt->stack[mt->top++] = s;
+}
+
+/* set the mark bit, returns true if this thread set it */
+static R_INLINE Rboolean TryMarkNode(SEXP s)
+{
+    sxpinfo_word_t *info = (sxpinfo_word_t *) &s->sxpinfo;
+
+    if (__atomic_load_n(info, __ATOMIC_RELAXED) & mark_bit)
+	return FALSE;
+    return (__atomic_fetch_or(info, mark_bit, __ATOMIC_RELAXED) & mark_bit) == 0;
+}
+
+#define PAR_FORWARD_NODE(s, mt) do { \
+  SEXP pf__n__ = (s); \
+  if (pf__n__ && TryMarkNode(pf__n__)) { \
+    CHECK_FOR_FREE_NODE(pf__n__) \
+    PushMarkStack(mt, pf__n__); \
+  } \
+} while (0)
+
+/* move the top chunk of a long mark stack to the pool */
+static void ShareMarkWork(mark_thread_t *mt)
+{
+    pthread_mutex_lock(&mark_mutex);
+    if (mark_pool_count + MARK_CHUNK > mark_pool_max) {
+	size_t max = mark_pool_max != 0 ? 2 * mark_pool_max : 16 * MARK_CHUNK;
+	SEXP *pool = realloc(mark_pool, max * sizeof(SEXP));
+	if (pool == NULL)
+	    mark_grow_failed();
+	mark_pool = pool;
+	mark_pool_max = max;
+    }
+    mt->top -= MARK_CHUNK;
+    memcpy(mark_pool + mark_pool_count, mt->stack + mt->top,
+	   MARK_CHUNK * sizeof(SEXP));
+    mark_pool_count += MARK_CHUNK;
+    pthread_cond_signal(&mark_work_cond);
+    pthread_mutex_unlock(&mark_mutex);
+}
+
+/* wait for a chunk from the pool, returns false once all threads are
+   waiting, as there is no work left then */
+static Rboolean GetMarkWork(mark_thread_t *mt)
+{
+    Rboolean found = FALSE;
+
+    pthread_mutex_lock(&mark_mutex);
+    __atomic_add_fetch(&mark_idle, 1, __ATOMIC_RELAXED);
+    while (mark_pool_count == 0 && !mark_done) {
+	if (mark_idle == mark_nthreads) {
+	    mark_done = TRUE;
+	    pthread_cond_broadcast(&mark_work_cond);
+	}
+	else
+	    pthread_cond_wait(&mark_work_cond, &mark_mutex);
+    }
+    __atomic_sub_fetch(&mark_idle, 1, __ATOMIC_RELAXED);
+
+    if (mark_pool_count != 0) {
+	size_t n = mark_pool_count < MARK_CHUNK ? mark_pool_count : MARK_CHUNK;
+	mark_pool_count -= n;
+	for (size_t i = 0; i < n; i++)
+	    PushMarkStack(mt, mark_pool[mark_pool_count + i]);
+	found = TRUE;
+    }
+    pthread_mutex_unlock(&mark_mutex);
+
+    return found;
+}
+
+static void MarkLoop(mark_thread_t *mt)
+{
+    do {
+	while (mt->top > 0) {
+	    SEXP s = mt->stack[--mt->top];
+	    DO_CHILDREN(s, PAR_FORWARD_NODE, mt);
+	    if (mt->top > 2 * MARK_CHUNK &&
+		__atomic_load_n(&mark_idle, __ATOMIC_RELAXED) > 0)
+		ShareMarkWork(mt);
+	}
+    } while (GetMarkWork(mt));
+}
+
+static void *MarkWorker(void *arg)
+{
+    mark_thread_t *mt = arg;
+
+    pthread_mutex_lock(&mark_mutex);
+    for (;;) {
+	while (mt->phase == mark_phase)
+	    pthread_cond_wait(&mark_start_cond, &mark_mutex);
+	mt->phase = mark_phase;
+	pthread_mutex_unlock(&mark_mutex);
+
+	MarkLoop(mt);
+
+	pthread_mutex_lock(&mark_mutex);
+	if (--mark_active == 0)
+	    pthread_cond_signal(&mark_done_cond);
+    }
+    return NULL;
+}
+
+/* the helper threads do not exist in a forked child */
+static void MarkAtForkChild(void)
+{
+    mark_nthreads = 0;
+    pthread_mutex_init(&mark_mutex, NULL);
+    pthread_cond_init(&mark_start_cond, NULL);
+    pthread_cond_init(&mark_work_cond, NULL);
+    pthread_cond_init(&mark_done_cond, NULL);
+}
+
+/* start the helper threads, returns the number of marking threads */
+static int StartMarkThreads(void)
+{
+    if (mark_nthreads != 0)
+	return mark_nthreads;
+
+    if (mark_threads == NULL) {
+	struct sxpinfo_struct info;
+
+	mark_threads = calloc(gc_mark_threads, sizeof(mark_thread_t));
+	if (mark_threads == NULL)
+	    return 1;
+	memset(&info, 0, sizeof(info));
+	info.mark = 1;
+	memcpy(&mark_bit, &info, sizeof(mark_bit));
+	pthread_atfork(NULL, NULL, MarkAtForkChild);
+    }
+
+    /* signals are handled by the main thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    mark_nthreads = 1;
+    for (int i = 1; i < gc_mark_threads; i++) {
+	pthread_t thread;
+
+	mark_threads[i].phase = mark_phase;
+	if (pthread_create(&thread, NULL, MarkWorker, &mark_threads[i]) != 0)
+	    break;
+	pthread_detach(thread);
+	mark_nthreads++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    /* no warning(), which could allocate */
+    if (mark_nthreads < gc_mark_threads)
+	REprintf(_("only %d of %d GC marking threads could be started\n"),
+		 mark_nthreads, gc_mark_threads);
+    return mark_nthreads;
+}
+
+/* mark everything reachable from the forwarded nodes in parallel and
+   move the marked nodes to their old generations like PROCESS_NODES */
+static Rboolean ParallelProcessNodes(SEXP forwarded_nodes)
+{
+    SEXP s, next;
+    mark_thread_t *main_thread;
+
+    if (StartMarkThreads() < 2)
+	return FALSE;
+
+    main_thread = &mark_threads[0];
+    for (s = forwarded_nodes; s != NULL; s = NEXT_NODE(s))
+	PushMarkStack(main_thread, s);
+
+    pthread_mutex_lock(&mark_mutex);
+    mark_done = FALSE;
+    mark_active = mark_nthreads - 1;
+    mark_phase++;
+    pthread_cond_broadcast(&mark_start_cond);
+    pthread_mutex_unlock(&mark_mutex);
+
+    MarkLoop(main_thread);
+
+    pthread_mutex_lock(&mark_mutex);
+    while (mark_active > 0)
+	pthread_cond_wait(&mark_done_cond, &mark_mutex);
+    pthread_mutex_unlock(&mark_mutex);
+
+    for (s = forwarded_nodes; s != NULL; s = next) {
+	next = NEXT_NODE(s);
+	SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].Old[NODE_GENERATION(s)]);
+	R_GenHeap[NODE_CLASS(s)].OldCount[NODE_GENERATION(s)]++;
+    }
+
+    for (int i = 0; i < NUM_NODE_CLASSES; i++) {
+	s = NEXT_NODE(R_GenHeap[i].New);
+	while (s != R_GenHeap[i].New) {
+	    next = NEXT_NODE(s);
+	    if (NODE_IS_MARKED(s)) {
+		UNSNAP_NODE(s);
+		SNAP_NODE(s, R_GenHeap[i].Old[NODE_GENERATION(s)]);
+		R_GenHeap[i].OldCount[NODE_GENERATION(s)]++;
+	    }
+	    s = next;
+	}
+    }
+
+    return TRUE;
+}
+#endif
+
+/* number of nodes in all old generations, which only grows while */
+/* the forwarded nodes are processed                              */
+static R_size_t OldNodeCount(void)
+{
+    R_size_t count = 0;
+
+    for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	    count += R_GenHeap[i].OldCount[gen];
+    return count;
+}
+
+/* number of nodes in the old generations above the youngest, which
+   are the ones promoted nodes go to */
+static R_size_t PromotedNodeCount(void)
+{
+    R_size_t count = 0;
+
+    for (int gen = 1; gen < NUM_OLD_GENERATIONS; gen++)
+	for (int i = 0; i < NUM_NODE_CLASSES; i++)
+	    count += R_GenHeap[i].OldCount[gen];
+    return count;
+}
+
+/* record the survival rate of a collection of level > 0 and adapt the
+   frequency of such collections to it */
+static void AdaptCollectCounts(int level, R_size_t collected,
+			       R_size_t survived)
+{
+    if (level == 0 || collected == 0)
+	return;
+    gen_old_collected[level - 1] += collected;
+    gen_old_survived[level - 1] += survived;
+
+    if (R_GCAdaptive) {
+	double survival = (double) survived / collected;
+	int base = collect_counts_base[level - 1];
+	int freq = collect_counts_max[level - 1];
+
+	if (survival > R_StableSurvival && freq < R_MaxFreqFactor * base)
+	    freq = 2 * freq < R_MaxFreqFactor * base ?
+		2 * freq : R_MaxFreqFactor * base;
+	else if (survival < R_UnstableSurvival && freq > base)
+	    freq = freq / 2 > base ? freq / 2 : base;
+	if (freq != collect_counts_max[level - 1])
+	    collect_counts_max[level - 1] = collect_counts[level - 1] = freq;
+    }
+}
+
 static void RunGenCollect(R_size_t size_needed)
 {
     int i, gen, gens_collected;
     RCNTXT *ctxt;
     SEXP s;
     SEXP forwarded_nodes;
+    R_size_t nodes_marked = 0, nodes_old, old_collected, promoted_old;
+    R_size_t nodes_before = R_NodesInUse;
+    R_size_t vsize_before = R_SmallVallocSize + R_LargeVallocSize;
 
     bad_sexp_type_seen = 0;
 
@@ -1551,6 +2355,7 @@ static void RunGenCollect(R_size_t size_needed)
 #ifndef EXPEL_OLD_TO_NEW
     /* eliminate old-to-new references in generations to collect by
        transferring referenced nodes to referring generation */
+    BEGIN_TIMER(TR_GCOldToNew);
     for (gen = 0; gen < num_old_gens_to_collect; gen++) {
 	for (i = 0; i < NUM_NODE_CLASSES; i++) {
 	    s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
@@ -1565,14 +2370,18 @@ static void RunGenCollect(R_size_t size_needed)
 	    }
 	}
     }
+    END_TIMER(TR_GCOldToNew);
 #endif
 
     DEBUG_CHECK_NODE_COUNTS("at start");
 
     /* unmark all marked nodes in old generations to be collected and
        move to New space */
+    BEGIN_TIMER(TR_GCUnmark);
+    old_collected = 0;
     for (gen = 0; gen < num_old_gens_to_collect; gen++) {
 	for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	    old_collected += R_GenHeap[i].OldCount[gen];
 	    R_GenHeap[i].OldCount[gen] = 0;
 	    s = NEXT_NODE(R_GenHeap[i].Old[gen]);
 	    while (s != R_GenHeap[i].Old[gen]) {
@@ -1586,20 +2395,28 @@ static void RunGenCollect(R_size_t size_needed)
 		BULK_MOVE(R_GenHeap[i].Old[gen], R_GenHeap[i].New);
 	}
     }
+    END_TIMER(TR_GCUnmark);
 
     forwarded_nodes = NULL;
+    nodes_old = OldNodeCount();
+    promoted_old = PromotedNodeCount();
 
 #ifndef EXPEL_OLD_TO_NEW
     /* scan nodes in uncollected old generations with old-to-new pointers */
-    for (gen = num_old_gens_to_collect; gen < NUM_OLD_GENERATIONS; gen++)
-	for (i = 0; i < NUM_NODE_CLASSES; i++)
-	    for (s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
-		 s != R_GenHeap[i].OldToNew[gen];
-		 s = NEXT_NODE(s))
-		FORWARD_CHILDREN(s);
+    {
+	BEGIN_TIMER(TR_GCOldToNew);
+	for (gen = num_old_gens_to_collect; gen < NUM_OLD_GENERATIONS; gen++)
+	    for (i = 0; i < NUM_NODE_CLASSES; i++)
+		for (s = NEXT_NODE(R_GenHeap[i].OldToNew[gen]);
+		     s != R_GenHeap[i].OldToNew[gen];
+		     s = NEXT_NODE(s))
+		    FORWARD_CHILDREN(s);
+	END_TIMER(TR_GCOldToNew);
+    }
 #endif
 
     /* forward all roots */
+    BEGIN_TIMER(TR_GCMarkRoots);
     FORWARD_NODE(R_NilValue);	           /* Builtin constants */
     FORWARD_NODE(NA_STRING);
     FORWARD_NODE(R_BlankString);
@@ -1679,11 +2496,21 @@ static void RunGenCollect(R_size_t size_needed)
     }
     FORWARD_NODE(R_CachedScalarReal);
     FORWARD_NODE(R_CachedScalarInteger);
+    END_TIMER(TR_GCMarkRoots);
 
     /* main processing loop */
+    BEGIN_TIMER(TR_GCMarkChildren);
+#ifdef PARALLEL_MARK
+    if (gc_mark_threads > 1 && gens_collected == NUM_OLD_GENERATIONS &&
+	ParallelProcessNodes(forwarded_nodes))
+	forwarded_nodes = NULL;
+    else
+#endif
     PROCESS_NODES();
+    END_TIMER(TR_GCMarkChildren);
 
     /* identify weakly reachable nodes */
+    BEGIN_TIMER(TR_GCWeakRefs);
     {
 	Rboolean recheck_weak_refs;
 	do {
@@ -1715,10 +2542,12 @@ static void RunGenCollect(R_size_t size_needed)
 	FORWARD_NODE(WEAKREF_FINALIZER(s));
     }
     PROCESS_NODES();
+    END_TIMER(TR_GCWeakRefs);
 
     DEBUG_CHECK_NODE_COUNTS("after processing forwarded list");
 
     /* process CHARSXP cache */
+    BEGIN_TIMER(TR_GCStringCache);
     if (R_StringHash != NULL) /* in case of GC during initialization */
     {
 	SEXP t;
@@ -1746,6 +2575,7 @@ static void RunGenCollect(R_size_t size_needed)
     }
     FORWARD_NODE(R_StringHash);
     PROCESS_NODES();
+    END_TIMER(TR_GCStringCache);
 
 #ifdef PROTECTCHECK
     for(i=0; i< NUM_SMALL_NODE_CLASSES;i++){
@@ -1788,9 +2618,14 @@ static void RunGenCollect(R_size_t size_needed)
     if (gc_inhibit_release)
 	PROCESS_NODES();
 #endif
+    nodes_marked += OldNodeCount() - nodes_old;
+    AdaptCollectCounts(gens_collected, old_collected,
+		       PromotedNodeCount() - promoted_old);
 
     /* release large vector allocations */
+    BEGIN_TIMER(TR_GCReleaseLarge);
     ReleaseLargeFreeVectors();
+    END_TIMER(TR_GCReleaseLarge);
 
     DEBUG_CHECK_NODE_COUNTS("after releasing large allocated nodes");
 
@@ -1850,6 +2685,8 @@ static void RunGenCollect(R_size_t size_needed)
 	SortNodes();
 #endif
 
+    QueueReleasedBlocks();
+
     if (R_check_constants > 2 ||
 	    (R_check_constants > 1 && gens_collected == NUM_OLD_GENERATIONS))
 	R_checkConstants(TRUE);
@@ -1861,6 +2698,13 @@ static void RunGenCollect(R_size_t size_needed)
 	REprintf(" (level %d) ... ", gens_collected);
 	DEBUG_GC_SUMMARY(gens_collected == NUM_OLD_GENERATIONS);
     }
+
+    R_size_t vsize_after = R_SmallVallocSize + R_LargeVallocSize;
+    timeR_gc_collected(gens_collected, nodes_marked,
+		       nodes_before > R_NodesInUse ?
+		       nodes_before - R_NodesInUse : 0,
+		       vsize_before > vsize_after ?
+		       (vsize_before - vsize_after) * sizeof(VECREC) : 0);
 }
 
 /* public interface for controlling GC torture settings */
@@ -2039,6 +2883,15 @@ void attribute_hidden InitMemory()
 
     init_gctorture();
     init_gc_grow_settings();
+    init_gc_collect_settings();
+    init_gc_arena_settings();
+    init_gc_huge_settings();
+#ifdef BACKGROUND_FREE
+    init_gc_free_settings();
+#endif
+#ifdef PARALLEL_MARK
+    init_gc_mark_settings();
+#endif
 
     gc_reporting = R_Verbose;
     R_StandardPPStackSize = R_PPStackSize;
@@ -2521,6 +3374,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    s->sxpinfo = UnmarkedNodeTemplate.sxpinfo;
 	    SET_NODE_CLASS(s, node_class);
 	    R_SmallVallocSize += alloc_size;
+	    TIMER_COUNT_BYTES(alloc_size * sizeof(VECREC));
 	    ATTRIB(s) = R_NilValue;
 	    SET_TYPEOF(s, type);
 	    SET_SHORT_VEC_LENGTH(s, (R_len_t) length); // is 1
@@ -2674,6 +3528,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    INIT_REFCNT(s);
 	    SET_NODE_CLASS(s, node_class);
 	    R_SmallVallocSize += alloc_size;
+	    TIMER_COUNT_BYTES(alloc_size * sizeof(VECREC));
 	    SET_SHORT_VEC_LENGTH(s, (R_len_t) length);
 	}
 	else {
@@ -2687,7 +3542,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    if (size < (R_SIZE_T_MAX / sizeof(VECREC)) - hdrsize) { /*** not sure this test is quite right -- why subtract the header? LT */
 		mem = allocator ?
 		    custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-		    malloc(hdrsize + size * sizeof(VECREC));
+		    AllocLargeVectorMem(hdrsize + size * sizeof(VECREC));
 		if (mem == NULL) {
 		    /* If we are near the address space limit, we
 		       might be short of address space.  So return
@@ -2695,7 +3550,7 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 		    R_gc_full(alloc_size);
 		    mem = allocator ?
 			custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-			malloc(hdrsize + size * sizeof(VECREC));
+			AllocLargeVectorMem(hdrsize + size * sizeof(VECREC));
 		}
 		if (mem != NULL) {
 #ifdef LONG_VECTOR_SUPPORT
@@ -2743,6 +3598,8 @@ SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator)
 	    if (!allocator) R_LargeVallocSize += size;
 	    R_GenHeap[node_class].AllocCount++;
 	    R_NodesInUse++;
+	    TIMER_COUNT_NODE();
+	    TIMER_COUNT_BYTES(size * sizeof(VECREC));
 	    SNAP_NODE(s, R_GenHeap[node_class].New);
 	}
 	ATTRIB(s) = R_NilValue;
@@ -2888,6 +3745,8 @@ static void R_gc_full(R_size_t size_needed)
 {
     num_old_gens_to_collect = NUM_OLD_GENERATIONS;
     R_gc_internal(size_needed);
+    /* callers are short of memory, so it has to be back in malloc */
+    WaitForReleasedBlocks();
 }
 
 static double gctimes[5], gcstarttimes[5];
@@ -3005,6 +3864,19 @@ static void R_gc_internal(R_size_t size_needed)
 	vcells = 0.1*ceil(10*vcells * vsfac/Mega);
 	REprintf("%.1f Mbytes of vectors used (%d%%)\n",
 		 vcells, (int) (vfrac + 0.5));
+	REprintf("Old nodes surviving:");
+	for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++) {
+	    REprintf("%s level %d ", gen ? "," : "", gen + 1);
+	    if (gen_old_collected[gen] > 0)
+		REprintf("%d%%", (int) (100.0 * gen_old_survived[gen] /
+					gen_old_collected[gen] + 0.5));
+	    else
+		REprintf("-");
+	}
+	REprintf("\nCollections before the next higher level:");
+	for (int gen = 0; gen < NUM_OLD_GENERATIONS; gen++)
+	    REprintf("%s level %d %d", gen ? "," : "", gen, collect_counts_max[gen]);
+	REprintf("\n");
     }
 
 #ifdef IMMEDIATE_FINALIZERS
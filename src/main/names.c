@@ -977,6 +977,8 @@ FUNTAB R_FunTab[] =
 {"traceR_idlemark", do_idlemark,0,     101,     1,      {PP_FUNCALL, PREC_FN,   0}},
 {"traceR_getchildfile",
                 do_getchildfile, 0,      1,     0,      {PP_FUNCALL, PREC_FN,   0}},
+{"traceR_bins", do_timeRbins,  0,      1,     0,      {PP_FUNCALL, PREC_FN,   0}},
+{"traceR_reset",do_timeRreset, 0,    101,     0,      {PP_FUNCALL, PREC_FN,   0}},
 
 {NULL,		NULL,		0,	0,	0,	{PP_INVALID, PREC_FN,	0}},
 };
@@ -1429,3 +1431,23 @@ SEXP do_getchildfile(SEXP call, SEXP op, SEXP args, SEXP rho) {
   SEXP ans = mkString(childfile);
   return ans;
 }
+
+SEXP do_timeRbins(SEXP call, SEXP op, SEXP args, SEXP rho) {
+  checkArity(op, args);
+#ifdef HAVE_TIME_R
+  return timeR_bins_dataframe();
+#else
+  error(_("R was not built with timeR support"));
+  return R_NilValue; /* -Wall */
+#endif
+}
+
+SEXP do_timeRreset(SEXP call, SEXP op, SEXP args, SEXP rho) {
+  checkArity(op, args);
+#ifdef HAVE_TIME_R
+  timeR_reset_all();
+#else
+  error(_("R was not built with timeR support"));
+#endif
+  return R_NilValue;
+}
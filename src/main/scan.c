@@ -42,6 +42,7 @@
 #include <Print.h>
 
 #include <rlocale.h> /* for btowc */
+#include "timeR.h"
 
 /* The size of vector initially allocated by scan */
 #define SCAN_BLOCKSIZE		1000
@@ -917,6 +918,7 @@ SEXP attribute_hidden do_scan(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("invalid '%s' argument"), "skipNul");
     data.skipNul = skipNul != 0;
 
+    BEGIN_IO_TIMER(TR_scan);
     i = asInteger(file);
     data.con = getConnection(i);
     if(i == 0) {
@@ -987,6 +989,7 @@ SEXP attribute_hidden do_scan(SEXP call, SEXP op, SEXP args, SEXP rho)
     if (!skipNul && data.embedWarn)
 	warning(_("embedded nul(s) found in input"));
 
+    END_IO_TIMER(TR_scan);
     UNPROTECT(1); /* ans */
     return ans;
 }
@@ -1811,29 +1811,27 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
             if (LENGTH(s) > 8 &&
 		streql(CHAR(STRING_ELT(cl, 0)),
 		       CHAR(PRINTNAME(R_SrcrefSymbol)))) {
-                /* create a new bin ID */
-                INTEGER(s)[8] = timeR_add_userfn_bin();
+		// FIXME: Semiduplicated from gram.y:getSrcfileFilename
+		const char *srcfilename = "(deserialized)";
+
+		SEXP srcfile = getAttrib(s, R_SrcfileSymbol);
+		if (isEnvironment(srcfile)) {
+		    SEXP filename = findVar(install("filename"), srcfile);
+		    if (isString(filename) && length(filename))
+			srcfilename = CHAR(STRING_ELT(filename, 0));
+		}
 
-		/* check for a saved bin name */
+		/* look up the bin by position and saved name, so loading */
+		/* the same code again does not add new bins              */
 		SEXP binname = getAttrib(s, install(TIME_R_BIN_NAME_ATTR));
 		if (binname != R_NilValue) {
-		    timeR_name_bin(INTEGER(s)[8], CHAR(binname));
+		    INTEGER(s)[8] = timeR_userfn_bin(srcfilename, INTEGER(s)[0],
+						     INTEGER(s)[4], CHAR(binname));
 		    /* hide our modification */
 		    setAttrib(s, install(TIME_R_BIN_NAME_ATTR), R_NilValue);
 		} else {
-		    // FIXME: Semiduplicated from gram.y:getSrcFileName
-		    const char *srcfilename = "(deserialized)";
-
-		    SEXP srcfile = getAttrib(s, R_SrcfileSymbol);
-		    if (isEnvironment(srcfile)) {
-			static SEXP filename_symbol;
-			SEXP filename = findVar(install("filename"), srcfile);
-			if (isString(filename) && length(filename))
-			    srcfilename = CHAR(STRING_ELT(filename, 0));
-		    }
-
-		    timeR_name_bin_anonfunc(INTEGER(s)[8], srcfilename,
-					    INTEGER(s)[0], INTEGER(s)[4]);
+		    INTEGER(s)[8] = timeR_anonfunc_bin(srcfilename, INTEGER(s)[0],
+						       INTEGER(s)[4]);
 		}
             }
         }
@@ -2915,6 +2913,12 @@ do_lazyLoadDBfetch(SEXP call, SEXP op, SEXP args, SEXP env)
 	val = eval(val, R_GlobalEnv);
 	SET_NAMED(val, 2);
     }
+    /* the variable is known if the call comes from makeLazy */
+    if (TIME_R_ENABLED && TYPEOF(val) == CLOSXP) {
+	REPROTECT(val, vpi);
+	timeR_name_closure(getAttrib(call, install(TIME_R_BINDING_ATTR)),
+			   val, CLOENV(val));
+    }
     UNPROTECT(1);
     return val;
 }
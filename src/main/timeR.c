@@ -30,8 +30,17 @@
 #include <sys/time.h>
 #include <sys/times.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <assert.h>
+#include <fcntl.h>
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+#include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,6 +48,10 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 #include <Defn.h>
 #include "timeR.h"
@@ -53,6 +66,7 @@ static char *bin_names[] = {
     // internal
     "OverheadTest1",    /* MARKER:ALWAYS */
     "OverheadTest2",    /* MARKER:ALWAYS */
+    "OverheadTest3",    /* MARKER:ALWAYS */
     "HashOverhead",
     // first timer in output is Startup
     "Startup",
@@ -64,6 +78,14 @@ static char *bin_names[] = {
     "allocList",
     "allocS4",
     "GCInternal",
+    "GCOldToNew",
+    "GCUnmark",
+    "GCMarkRoots",
+    "GCMarkChildren",
+    "GCWeakRefs",
+    "GCStringCache",
+    "GCReleaseLarge",
+    "GCReleasePages",
 
     // dotcode.c
     "dotExternalFull",
@@ -93,6 +115,19 @@ static char *bin_names[] = {
     // names.c
     "do_internal",
 
+    // connections.c
+    "fileRead",
+    "gzfileRead",
+
+    // Rsock.c
+    "sockRead",
+
+    // scan.c
+    "scan",
+
+    // sys-unix.c
+    "System",
+
     // add your own timers here
 
     /* MARKER:END */
@@ -112,24 +147,95 @@ _Static_Assert(sizeof(bin_names)/sizeof(bin_names[0]) == TR_StaticBinCount,
 /* fallback name if string duplication fails */
 static char *userfunc_unknown_str = "unknown_user_function";
 
-/* timer list */
-static unsigned int max_mbindex;
-tr_timer_t  *timeR_measureblocks[TIME_R_MAX_MBLOCKS];
-unsigned int timeR_current_mblockidx;
-tr_timer_t  *timeR_current_mblock;
-unsigned int timeR_next_mindex; // always points to a free timer entry
-timeR_t      timeR_current_lower_sum;
+/* timer stack of the calling thread */
+TIME_R_TLS tr_timer_t  *timeR_stack;       // the very first timer is just a canary
+TIME_R_TLS tr_timer_t  *timeR_stack_top;   // always points to a free timer entry
+TIME_R_TLS tr_timer_t  *timeR_stack_limit;
+TIME_R_TLS timeR_t      timeR_current_lower_sum;
+static timeR_t deep_overhead;
+
+/* allocation accounting */
+TIME_R_TLS uint64_t     timeR_alloc_nodes;
+TIME_R_TLS uint64_t     timeR_alloc_bytes;
+TIME_R_TLS uint64_t     timeR_alloc_lower_nodes;
+TIME_R_TLS uint64_t     timeR_alloc_lower_bytes;
+TIME_R_TLS tr_alloc_t  *timeR_alloc_stack;
+
+/* overhead compensation */
+TIME_R_TLS uint64_t     timeR_nested_starts;
+TIME_R_TLS uint64_t     timeR_nested_lower;
+TIME_R_TLS tr_nested_t *timeR_nested_stack;
+
+/* performance counters */
+TIME_R_TLS unsigned int timeR_counter_count;
+static char  counter_labels[TIME_R_MAX_COUNTERS * 64];
+static const char *counter_names[TIME_R_MAX_COUNTERS];
 
 /* bins */
 static unsigned int next_bin = TR_StaticBinCount;
 static unsigned int bin_count;
 static unsigned int first_userfn_idx;
-tr_bin_t *timeR_bins;  // is realloc()'d, no pointers to elements please!
+TIME_R_TLS tr_bin_t *timeR_bins;  // is realloc()'d, no pointers to elements please!
 
 // fork support
 static char **childfiles;
 static unsigned int childfiles_count;
 static unsigned int childfiles_max;
+static unsigned int fork_depth;
+
+/* forked children publish their bins in a shared memory segment that */
+/* is created before the first fork and inherited by all descendants  */
+typedef struct {
+    uint64_t     used;       /* bytes handed out to records, atomic */
+    uint32_t     overflows;  /* children whose record did not fit, atomic */
+    uint32_t     pad;
+    /* children that wrote their results to <output>_<pid> instead, */
+    /* 0 until the slot is written                                   */
+    int32_t      overflow_pids[TIME_R_MAX_CHILD_OVERFLOWS];
+} tr_childshm_t;
+
+/* one record per child process, followed by its bins */
+typedef struct {
+    uint64_t     size;       /* bytes including the bins, 0 until reserved */
+    uint32_t     ready;      /* TR_CHILD_READY once the record is complete */
+    uint32_t     bins;       /* number of bins in the record */
+    int32_t      pid;
+    int32_t      parent;
+    uint32_t     depth;      /* 1 for children of the main process */
+    uint32_t     pad;
+    timeR_t      runtime;
+    double       user_time;
+    double       system_time;
+} tr_childrec_t;
+
+/* one bin of a child, followed by prefix, name and the histogram */
+typedef struct {
+    uint32_t     size;       /* bytes including names and histogram */
+    uint32_t     prefix_len; /* including the terminating 0, 0 without prefix */
+    uint32_t     name_len;   /* including the terminating 0 */
+    uint32_t     bcode:1;
+    uint32_t     has_hist:1;
+    timeR_t      sum_self;
+    timeR_t      sum_total;
+    timeR_t      max;
+    uint64_t     starts;
+    uint64_t     aborts;
+    uint64_t     nodes_self;
+    uint64_t     nodes_total;
+    uint64_t     bytes_self;
+    uint64_t     bytes_total;
+    uint64_t     wall_ns;
+    uint64_t     cpu_ns;
+    uint64_t     counters[2 * TIME_R_MAX_COUNTERS];
+} tr_childbin_t;
+
+#define TR_CHILD_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+/* values of tr_childrec_t.ready */
+#define TR_CHILD_READY      1
+#define TR_CHILD_OVERFLOWED 2  /* reserved beyond the end, holds no bins */
+
+static tr_childshm_t *child_shm;
 
 /* external function timing */
 typedef struct {
@@ -141,6 +247,43 @@ static tr_extfunc_entry_t *extfunc_map;
 static unsigned int extfunc_map_length;
 static unsigned int extfunc_map_entries;
 
+/* user function, statement and external bins by file and name, so  */
+/* re-parsed or re-loaded code keeps using the same bin; the names of */
+/* anonymous functions and statements contain their position         */
+static unsigned int *bin_map; // bin id per slot, 0 is empty
+static unsigned int  bin_map_length;
+static unsigned int  bin_map_entries;
+
+/* measurement state of a helper thread, the bins are indexed like */
+/* those of the main thread up to TR_StaticBinCount, followed by   */
+/* the named timers of the thread                                  */
+typedef struct tr_thread {
+    struct tr_thread *next;
+    tr_bin_t         *bins;
+    unsigned int      next_bin;
+    unsigned int      bin_count;
+} tr_thread_t;
+
+static TIME_R_TLS tr_thread_t *thread_state;  // NULL in the main thread
+
+/* threads that did not end yet and the merged bins of the others, */
+/* all protected by thread_mutex                                   */
+static tr_thread_t    *threads;
+static tr_bin_t       *thread_bins;
+static unsigned int    thread_bin_count, thread_bin_max;
+static unsigned int    threads_measured;
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* garbage collections by the number of old generations collected */
+typedef struct {
+    uint64_t collections;
+    uint64_t nodes_marked;
+    uint64_t nodes_freed;
+    uint64_t bytes_freed;
+} tr_gc_level_t;
+
+static tr_gc_level_t gc_levels[TIME_R_MAX_GC_LEVELS];
 
 /* additional hardcoded timers */
 static tr_measureptr_t startup_mptr;
@@ -157,14 +300,87 @@ static idletime_t *idletimes;
 static unsigned int idletime_cur, idletime_max;
 
 
+/* run-time timer selection */
+char timeR_static_enabled[TR_StaticBinCount];
+int  timeR_funtab_enabled   = 1;
+int  timeR_userfunc_enabled = 1;
+int  timeR_extfunc_enabled  = 1;
+long timeR_sample_rate      = 1;
+int  timeR_histograms       = 0;
+int  timeR_line_bins        = 0;
+int  timeR_bcops_enabled    = 1;
+
+/* byte-code instructions */
+unsigned int       timeR_bcop_current = TR_BCOP_NONE;
+timeR_t            timeR_bcop_start;
+timeR_t            timeR_bcop_self[TIME_R_MAX_BCOPS + 1];
+unsigned long long timeR_bcop_count[TIME_R_MAX_BCOPS + 1];
+static const char *bcop_names[TIME_R_MAX_BCOPS];
+static unsigned int bcop_count;
+
+/* call tree */
+#define CT_ROOT     0   /* outermost context, never written to the output */
+#define CT_OVERFLOW 1   /* receives everything once the node limit is hit */
+
+TIME_R_TLS tr_ctnode_t  *timeR_ctnodes;
+TIME_R_TLS unsigned int  timeR_current_ctnode;
+static unsigned int  ctnode_count, ctnode_max, ctnode_dropped;
+static unsigned int *ctnode_hash; // node index per slot, 0 is empty
+static unsigned int  ctnode_hash_size;
+
+/* output column labels of the allocation counters */
+#define ALLOC_LABELS "\tnodes_self\tnodes_total\tbytes_self\tbytes_total"
+
+/* binary trace */
+#define TRACE_DATA_OFFSET 4096  /* file offset of the first event */
+
+typedef struct {
+    char     magic[8];          /* "timeRtrc" */
+    uint32_t version;
+    uint32_t event_size;        /* sizeof(tr_event_t) */
+    int64_t  start;             /* clock value the first delta refers to */
+    uint64_t events;            /* number of events in the file */
+    uint64_t names_offset;      /* file offset of the bin name table */
+    uint64_t stalls;            /* times the interpreter waited for the writer */
+    char     unit[32];          /* TIME_R_UNIT */
+} tr_trace_header_t;
+
+TIME_R_TLS int         timeR_trace_enabled;
+TIME_R_TLS tr_event_t *timeR_trace_next;
+TIME_R_TLS tr_event_t *timeR_trace_limit;
+TIME_R_TLS timeR_t     timeR_trace_last;
+
+static tr_event_t     *trace_chunks[TIME_R_TRACE_CHUNKS];
+static unsigned int    trace_chunk_len[TIME_R_TRACE_CHUNKS]; // 0 if free
+static unsigned int    trace_prod_idx, trace_cons_idx;
+static bool            trace_stop;
+static int             trace_fd = -1;
+static uint64_t        trace_events_written; // only used by the writer
+static uint64_t        trace_stalls;
+static pthread_t       trace_thread;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  trace_cond  = PTHREAD_COND_INITIALIZER;
+
 char *timeR_output_file;
 int   timeR_output_raw     = 0;
+int   timeR_output_json    = 0;
 int   timeR_reduced_output = 1;
 int   timeR_exclude_init   = 0;
 long  timeR_scale          = 1;
+char *timeR_calltree_file;
+unsigned int timeR_calltree_max = TIME_R_CALLTREE_MAX_NODES;
+char *timeR_trace_file;
 
 /*** internal functions ***/
 
+static void reset_calltree(void);
+static void timeR_dump_calltree(FILE *fd);
+static void trace_start(const char *filename);
+static void trace_finish(void);
+static void reset_counters(void);
+static void reopen_counters(void);
+static void dump_threads(FILE *fd);
+
 static void add_childfile(char *orig_name) {
   char *name = strdup(orig_name);
   if (!name)
@@ -192,26 +408,6 @@ static void add_childfile(char *orig_name) {
   childfiles[childfiles_count++] = name;
 }
 
-static int compare_binnames(const void *a_void, const void *b_void) {
-    const tr_bin_t * const *a = a_void;
-    const tr_bin_t * const *b = b_void;
-
-    int res = 0;
-
-    if ((*a)->prefix != NULL && (*b)->prefix != NULL) {
-	res = strcmp((*a)->prefix, (*b)->prefix);
-    } else if ((*a)->prefix == NULL && (*b)->prefix != NULL) {
-	return -1;
-    } else if ((*a)->prefix != NULL && (*b)->prefix == NULL) {
-	return 1;
-    }
-
-    if (res == 0)
-	res = strcmp((*a)->name, (*b)->name);
-
-    return res;
-}
-
 static int compare_selftime_desc(const void *a_void, const void *b_void) {
     const tr_bin_t * const *a = a_void;
     const tr_bin_t * const *b = b_void;
@@ -224,37 +420,39 @@ static int compare_selftime_desc(const void *a_void, const void *b_void) {
 	return 0;
 }
 
-/* merge duplicated bins by name */
-static void merge_dupes(tr_bin_t **binpointers, unsigned int count) {
-    qsort(binpointers, count, sizeof(tr_bin_t *),
-	  compare_binnames);
+/* upper end of the bucket that contains the given fraction of all calls */
+static timeR_t hist_percentile(const tr_bin_t *bin, double fraction) {
+    unsigned long long count = 0, seen = 0;
 
-    tr_bin_t *prev_bin = binpointers[0];
+    for (unsigned int i = 0; i < TR_HIST_BUCKETS; i++)
+	count += bin->hist[i];
 
-    for (unsigned int i = 1; i < next_bin - first_userfn_idx; i++) {
-	tr_bin_t *cur_bin = binpointers[i];
+    unsigned long long target = (unsigned long long)(fraction * count + 0.5);
+    if (target == 0)
+	target = 1;
 
-	if (!compare_binnames(&prev_bin, &cur_bin)) {
-	    // same name, merge and disable the current one
-	    prev_bin->sum_self  += cur_bin->sum_self;
-	    prev_bin->sum_total += cur_bin->sum_total;
-	    prev_bin->starts    += cur_bin->starts;
-	    prev_bin->aborts    += cur_bin->aborts;
-	    prev_bin->bcode     |= cur_bin->bcode;
+    for (unsigned int i = 0; i < TR_HIST_BUCKETS; i++) {
+	seen += bin->hist[i];
+	if (seen < target)
+	    continue;
 
-	    cur_bin->name[0]   = 0;
-	    cur_bin->sum_self  = 0;
-	    cur_bin->sum_total = 0;
-	    cur_bin->starts    = 0;
+	timeR_t upper;
+	if (i < TR_HIST_SUB) {
+	    upper = i;
 	} else {
-	    prev_bin = cur_bin;
+	    unsigned int shift = i / TR_HIST_SUB - 1;
+	    upper = ((timeR_t)(TR_HIST_SUB + i % TR_HIST_SUB + 1) << shift) - 1;
 	}
+
+	return upper < bin->max ? upper : bin->max;
     }
+
+    return bin->max;
 }
 
 static void timeR_print_bin(FILE *fd, tr_bin_t *bin, bool force,
-			    timeR_t all_self) {
-    if (timeR_reduced_output && bin->starts == 0 && !force)
+			    timeR_t all_self, bool hist) {
+    if ((timeR_reduced_output || bin->successor != 0) && bin->starts == 0 && !force)
 	return;
 
     if (bin->prefix != NULL)
@@ -265,71 +463,86 @@ static void timeR_print_bin(FILE *fd, tr_bin_t *bin, bool force,
     if (all_self != 0)
 	fprintf(fd, "%.2f%%\t", (double)bin->sum_self / all_self * 100.0);
 
-    fprintf(fd, "%lld\t" "%lld\t" "%llu\t" "%llu\t" "%d\n",
+    fprintf(fd, "%lld\t" "%lld\t" "%llu\t" "%llu\t" "%d",
             bin->sum_self  / timeR_scale,
             bin->sum_total / timeR_scale,
             bin->starts,
             bin->aborts,
             bin->bcode);
+
+    if (timeR_alloc_stack != NULL)
+	fprintf(fd, "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64,
+		bin->nodes_self, bin->nodes_total,
+		bin->bytes_self, bin->bytes_total);
+
+    for (unsigned int i = 0; i < timeR_counter_count; i++)
+	fprintf(fd, "\t%" PRIu64 "\t%" PRIu64,
+		bin->counters != NULL ? bin->counters[2*i]   : 0,
+		bin->counters != NULL ? bin->counters[2*i+1] : 0);
+
+    if (hist) {
+	if (bin->hist != NULL)
+	    fprintf(fd, "\t%lld\t" "%lld\t" "%lld\t" "%lld",
+		    hist_percentile(bin, 0.50) / timeR_scale,
+		    hist_percentile(bin, 0.90) / timeR_scale,
+		    hist_percentile(bin, 0.99) / timeR_scale,
+		    bin->max / timeR_scale);
+	else
+	    fprintf(fd, "\t0\t0\t0\t0");
+    }
+
+    fprintf(fd, "\n");
+}
+
+#ifdef TIME_R_FUNTAB
+/* sum up the function table timers by type */
+static void sum_funtab(tr_bin_t *builtins, tr_bin_t *specials) {
+    memset(builtins, 0, sizeof(tr_bin_t));
+    memset(specials, 0, sizeof(tr_bin_t));
+
+    for (int i = 0; R_FunTab[i].name != NULL; i++) {
+	tr_bin_t *bin = &timeR_bins[TR_StaticBinCount + i];
+	tr_bin_t *sum = (R_FunTab[i].eval % 10) == 0 ? specials : builtins;
+
+	sum->sum_self  += bin->sum_self;
+	sum->sum_total += bin->sum_total;
+	sum->starts    += bin->starts;
+	sum->aborts    += bin->aborts;
+    }
 }
+#endif
 
 static void timeR_dump_raw(FILE *fd) {
 #ifdef TIME_R_FUNTAB
     /* calculate and print sums for the builtin/special timers */
-    timeR_t            bself_sum  = 0, btotal_sum = 0, sself_sum  = 0, stotal_sum = 0;
-    unsigned long long bstart_sum = 0, babort_sum = 0, sstart_sum = 0, sabort_sum = 0;
-
-    int i = 0;
-    while (R_FunTab[i].name != NULL) {
-	unsigned int bin_id = TR_StaticBinCount + i;
-
-	if ((R_FunTab[i].eval % 10) == 0) {
-	    /* SPECIALSXP */
-	    sself_sum  += timeR_bins[bin_id].sum_self;
-	    stotal_sum += timeR_bins[bin_id].sum_total;
-	    sstart_sum += timeR_bins[bin_id].starts;
-	    sabort_sum += timeR_bins[bin_id].aborts;
-	} else {
-	    /* BUILTINSXP */
-	    bself_sum  += timeR_bins[bin_id].sum_self;
-	    btotal_sum += timeR_bins[bin_id].sum_total;
-	    bstart_sum += timeR_bins[bin_id].starts;
-	    babort_sum += timeR_bins[bin_id].aborts;
-	}
+    tr_bin_t builtins, specials;
 
-	i++;
-    }
+    sum_funtab(&builtins, &specials);
 
     fprintf(fd, "#!LABEL\tself\ttotal\tcalls\taborts\n");
 
     fprintf(fd, "BuiltinSum\t%lld\t%lld\t%llu\t%llu\n",
-	    bself_sum  / timeR_scale,
-	    btotal_sum / timeR_scale,
-	    bstart_sum, babort_sum);
+	    builtins.sum_self  / timeR_scale,
+	    builtins.sum_total / timeR_scale,
+	    builtins.starts, builtins.aborts);
     fprintf(fd, "SpecialSum\t%lld\t%lld\t%llu\t%llu\n",
-	    sself_sum  / timeR_scale,
-	    stotal_sum / timeR_scale,
-	    sstart_sum, sabort_sum);
+	    specials.sum_self  / timeR_scale,
+	    specials.sum_total / timeR_scale,
+	    specials.starts, specials.aborts);
 #endif
 
 #if defined(TIME_R_USERFUNCTIONS) || defined(TIME_R_EXTFUNC)
-    /* sort the user function timers by name */
-    tr_bin_t **binpointers = malloc(sizeof(tr_bin_t *) * (next_bin - first_userfn_idx));
-    if (binpointers == NULL)
-	abort();
-
-    // use this opportunity to calculate the user function sum too
+    /* calculate the user function sum */
     timeR_t            uself_sum  = 0, utotal_sum = 0;
     unsigned long long ustart_sum = 0, uabort_sum = 0;
 
     for (unsigned int i = 0; i < next_bin - first_userfn_idx; i++) {
 	tr_bin_t *bin = &timeR_bins[i + first_userfn_idx];
 
-	binpointers[i] = bin;
-	uself_sum     += bin->sum_self;
-	utotal_sum    += bin->sum_total;
-	ustart_sum    += bin->starts;
-	uabort_sum    += bin->aborts;
+	uself_sum  += bin->sum_self;
+	utotal_sum += bin->sum_total;
+	ustart_sum += bin->starts;
+	uabort_sum += bin->aborts;
     }
 
     fprintf(fd, "#!LABEL\tself\ttotal\tcalls\taborts\n");
@@ -340,48 +553,40 @@ static void timeR_dump_raw(FILE *fd) {
 	    utotal_sum / timeR_scale,
 	    ustart_sum, uabort_sum);
 #  endif
-
-    merge_dupes(binpointers, next_bin - first_userfn_idx);
 #endif // TIME_R_USERFUNCTIONS
 
     /* print static and function table timers */
-    fprintf(fd, "#!LABEL\tself\ttotal\tcalls\taborts\thas_bcode\n");
+    fprintf(fd, "#!LABEL\tself\ttotal\tcalls\taborts\thas_bcode%s%s\n",
+	    timeR_alloc_stack != NULL ? ALLOC_LABELS : "", counter_labels);
 
 #if !defined(TIME_R_STATICTIMERS) && defined(TIME_R_USERFUNCTIONS)
     // ensure the fallback timer is printed if static timers are off
-    timeR_print_bin(fd, &timeR_bins[TR_UserFuncFallback], true, 0);
+    timeR_print_bin(fd, &timeR_bins[TR_UserFuncFallback], true, 0, false);
 #endif
 
 #ifdef TIME_R_STATICTIMERS
     for (unsigned int i = TR_Startup; i < TR_StaticBinCount; i++) {
 	/* skip disabled timers */
-	if (!timer_enables[i])
+	if (!timer_enables[i] || !timeR_static_enabled[i])
 	    continue;
 
-	timeR_print_bin(fd, &timeR_bins[i], true, 0);
+	timeR_print_bin(fd, &timeR_bins[i], true, 0, false);
     }
 #endif
 
 #ifdef TIME_R_EXTFUNC
-    timeR_print_bin(fd, &timeR_bins[TR_HashOverhead], false, 0);
+    timeR_print_bin(fd, &timeR_bins[TR_HashOverhead], false, 0, false);
 #endif
 
 #ifdef TIME_R_FUNTAB
     for (unsigned int i = TR_StaticBinCount; i < first_userfn_idx; i++)
-	timeR_print_bin(fd, &timeR_bins[i], false, 0);
+	timeR_print_bin(fd, &timeR_bins[i], false, 0, false);
 #endif
 
 #if defined(TIME_R_USERFUNCTIONS) || defined(TIME_R_EXTFUNC)
-    /* print user function timers */
-    for (unsigned int i = 0; i < next_bin - first_userfn_idx; i++) {
-	tr_bin_t *bin = binpointers[i];
-
-	if (bin->name[0] != 0)
-	    /* print only if it has a name */
-	    timeR_print_bin(fd, bin, false, 0);
-    }
-
-    free(binpointers);
+    /* print user function timers in the order they were created */
+    for (unsigned int i = first_userfn_idx; i < next_bin; i++)
+	timeR_print_bin(fd, &timeR_bins[i], false, 0, false);
 #endif
 }
 
@@ -389,42 +594,22 @@ static void timeR_dump_raw(FILE *fd) {
 static void timeR_dump_processed(FILE *fd, timeR_t total_runtime) {
 #ifdef TIME_R_FUNTAB
     /* calculate and print sums for the builtin/special timers */
-    timeR_t            bself_sum  = 0, btotal_sum = 0, sself_sum  = 0, stotal_sum = 0;
-    unsigned long long bstart_sum = 0, babort_sum = 0, sstart_sum = 0, sabort_sum = 0;
-
-    int i = 0;
-    while (R_FunTab[i].name != NULL) {
-	unsigned int bin_id = TR_StaticBinCount + i;
-
-	if ((R_FunTab[i].eval % 10) == 0) {
-	    /* SPECIALSXP */
-	    sself_sum  += timeR_bins[bin_id].sum_self;
-	    stotal_sum += timeR_bins[bin_id].sum_total;
-	    sstart_sum += timeR_bins[bin_id].starts;
-	    sabort_sum += timeR_bins[bin_id].aborts;
-	} else {
-	    /* BUILTINSXP */
-	    bself_sum  += timeR_bins[bin_id].sum_self;
-	    btotal_sum += timeR_bins[bin_id].sum_total;
-	    bstart_sum += timeR_bins[bin_id].starts;
-	    babort_sum += timeR_bins[bin_id].aborts;
-	}
+    tr_bin_t builtins, specials;
 
-	i++;
-    }
+    sum_funtab(&builtins, &specials);
 
     fprintf(fd, "#!LABEL\tself_percentage\tself\ttotal\tcalls\taborts\n");
 
     fprintf(fd, "BuiltinSum\t%.2f%%\t%lld\t%lld\t%llu\t%llu\n",
-	    (double)bself_sum / total_runtime * 100.0,
-	    bself_sum  / timeR_scale,
-	    btotal_sum / timeR_scale,
-	    bstart_sum, babort_sum);
+	    (double)builtins.sum_self / total_runtime * 100.0,
+	    builtins.sum_self  / timeR_scale,
+	    builtins.sum_total / timeR_scale,
+	    builtins.starts, builtins.aborts);
     fprintf(fd, "SpecialSum\t%.2f%%\t%lld\t%lld\t%llu\t%llu\n",
-	    (double)sself_sum / total_runtime * 100.0,
-	    sself_sum  / timeR_scale,
-	    stotal_sum / timeR_scale,
-	    sstart_sum, sabort_sum);
+	    (double)specials.sum_self / total_runtime * 100.0,
+	    specials.sum_self  / timeR_scale,
+	    specials.sum_total / timeR_scale,
+	    specials.starts, specials.aborts);
 #endif
 
 #ifdef TIME_R_USERFUNCTIONS
@@ -449,7 +634,7 @@ static void timeR_dump_processed(FILE *fd, timeR_t total_runtime) {
 	    ustart_sum, uabort_sum);
 #endif
 
-    /* sort timers by name to remove duplicates */
+    /* sort timers by self time, descending */
     tr_bin_t **binpointers = malloc(sizeof(tr_bin_t *) * next_bin);
     if (binpointers == NULL)
 	abort();
@@ -457,31 +642,345 @@ static void timeR_dump_processed(FILE *fd, timeR_t total_runtime) {
     for (unsigned int i = TR_Startup; i < next_bin; i++)
 	binpointers[i - TR_Startup] = timeR_bins + i;
 
-    merge_dupes(binpointers, next_bin - TR_Startup);
-
-    /* now sort by self time, descending */
     qsort(binpointers, next_bin - TR_Startup, sizeof(tr_bin_t *),
 	  compare_selftime_desc);
 
     /* print all timers */
-    fprintf(fd, "# --- individual timers\tself_percentage\tself\ttotal\tcalls\taborts\thas_bcode\n");
+    fprintf(fd, "# --- individual timers\tself_percentage\tself\ttotal\tcalls\taborts\thas_bcode%s%s%s\n",
+	    timeR_alloc_stack != NULL ? ALLOC_LABELS : "", counter_labels,
+	    timeR_histograms ? "\tp50\tp90\tp99\tmax" : "");
 
-    for (unsigned int i = TR_Startup; i < next_bin; i++) {
-	tr_bin_t *bin = binpointers[i - TR_Startup];
+    for (unsigned int i = TR_Startup; i < next_bin; i++)
+	timeR_print_bin(fd, binpointers[i - TR_Startup], false, total_runtime,
+			timeR_histograms);
+
+    free(binpointers);
+}
+
+static int compare_bcop_self_desc(const void *a_void, const void *b_void) {
+    unsigned int a = *(const unsigned int *)a_void;
+    unsigned int b = *(const unsigned int *)b_void;
+
+    if (timeR_bcop_self[a] < timeR_bcop_self[b])
+	return 1;
+    else if (timeR_bcop_self[a] > timeR_bcop_self[b])
+	return -1;
+    else
+	return 0;
+}
+
+/* list the byte-code instructions that were executed, sorted by */
+/* self time unless the output is raw                             */
+static void dump_bcops(FILE *fd) {
+    unsigned int ops[TIME_R_MAX_BCOPS];
+    unsigned int count = 0;
+
+    for (unsigned int i = 0; i < bcop_count; i++)
+	if (timeR_bcop_count[i] != 0)
+	    ops[count++] = i;
+
+    if (count == 0)
+	return;
+
+    if (!timeR_output_raw)
+	qsort(ops, count, sizeof(unsigned int), compare_bcop_self_desc);
+
+    if (timeR_output_json) {
+	fprintf(fd, ",\n\"bcops\": [");
+	for (unsigned int i = 0; i < count; i++)
+	    fprintf(fd, "%s\n  {\"name\": \"%s\", \"self\": %lld, \"calls\": %llu}",
+		    i == 0 ? "" : ",", bcop_names[ops[i]],
+		    timeR_bcop_self[ops[i]] / timeR_scale, timeR_bcop_count[ops[i]]);
+	fprintf(fd, "\n]");
+	return;
+    }
+
+    fprintf(fd, "#!LABEL\tinstruction\tself\tcalls\n");
+    fprintf(fd, "#!TABLE\tBCOp\tBytecodeInstructions\n");
+    for (unsigned int i = 0; i < count; i++)
+	fprintf(fd, "BCOp\t%s\t%lld\t%llu\n", bcop_names[ops[i]],
+		timeR_bcop_self[ops[i]] / timeR_scale, timeR_bcop_count[ops[i]]);
+}
+
+
+/* wall and thread CPU time of the timers that may block, the JSON */
+/* output has them as fields of the bins                           */
+static void dump_cpu_split(FILE *fd) {
+    bool first = true;
+
+    for (unsigned int i = TR_Startup; i < TR_StaticBinCount; i++) {
+	tr_bin_t *bin = &timeR_bins[i];
+
+	if (bin->wall_ns == 0)
+	    continue;
+
+	if (first) {
+	    fprintf(fd, "#!LABEL\tname\tcalls\twall_ns\tcpu_ns\toff_cpu_ns\n");
+	    fprintf(fd, "#!TABLE\tCPUSplit\tWallAndCPUTime\n");
+	    first = false;
+	}
+	fprintf(fd, "CPUSplit\t%s\t%llu\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+		bin->name, bin->starts, bin->wall_ns, bin->cpu_ns,
+		bin->wall_ns > bin->cpu_ns ? bin->wall_ns - bin->cpu_ns : 0);
+    }
+}
 
-	if (bin->name[0] != 0)
-	    timeR_print_bin(fd, bin, false, total_runtime);
+/* the collection statistics by level, only if R collected at all */
+static void dump_gc_levels(FILE *fd) {
+    bool first = true;
+    uint64_t collections = 0;
+
+    for (unsigned int i = 0; i < TIME_R_MAX_GC_LEVELS; i++)
+	collections += gc_levels[i].collections;
+
+    if (collections == 0)
+	return;
+
+    if (timeR_output_json)
+	fprintf(fd, ",\n\"gc_levels\": [");
+    else {
+	fprintf(fd, "#!LABEL\tlevel\tcollections\tnodes_marked\tnodes_freed\tbytes_freed\n");
+	fprintf(fd, "#!TABLE\tGCLevel\tGarbageCollections\n");
+    }
+
+    for (unsigned int i = 0; i < TIME_R_MAX_GC_LEVELS; i++) {
+	tr_gc_level_t *l = &gc_levels[i];
+
+	if (l->collections == 0)
+	    continue;
+
+	if (timeR_output_json)
+	    fprintf(fd, "%s\n  {\"level\": %u, \"collections\": %" PRIu64
+		    ", \"nodes_marked\": %" PRIu64 ", \"nodes_freed\": %" PRIu64
+		    ", \"bytes_freed\": %" PRIu64 "}", first ? "" : ",", i,
+		    l->collections, l->nodes_marked, l->nodes_freed, l->bytes_freed);
+	else
+	    fprintf(fd, "GCLevel\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+		    i, l->collections, l->nodes_marked, l->nodes_freed, l->bytes_freed);
+	first = false;
+    }
+
+    if (timeR_output_json)
+	fprintf(fd, "\n]");
+}
+
+/*** structured output ***/
+
+/* write a JSON string, or null for NULL */
+static void json_string(FILE *fd, const char *str) {
+    if (str == NULL) {
+	fputs("null", fd);
+	return;
+    }
+
+    fputc('"', fd);
+    for (const unsigned char *c = (const unsigned char *)str; *c != 0; c++) {
+	if (*c == '"' || *c == '\\')
+	    fprintf(fd, "\\%c", *c);
+	else if (*c < 0x20)
+	    fprintf(fd, "\\u%04x", *c);
+	else
+	    fputc(*c, fd);
+    }
+    fputc('"', fd);
+}
+
+/* run-time selection group of a bin, see timeR_select_timers; the  */
+/* bins of forked children only have a name, so it is derived from it */
+static const char *bin_group(const tr_bin_t *bin) {
+    if (bin->prefix != NULL)
+	return strcmp(bin->prefix, "<ExternalCode>") ? "funtab" : "external";
+
+    for (unsigned int i = 0; i < TR_StaticBinCount; i++)
+	if (!strcmp(bin->name, bin_names[i]))
+	    return "static";
+
+    return "userfunc";
+}
+
+/* one bin as a JSON object on a line of its own */
+static void json_print_bin(FILE *fd, tr_bin_t *bin) {
+    fputs("  {\"group\": ", fd);
+    json_string(fd, bin_group(bin));
+    fputs(", \"prefix\": ", fd);
+    json_string(fd, bin->prefix);
+    fputs(", \"name\": ", fd);
+    json_string(fd, bin->name);
+    fputs(", \"file\": ", fd);
+    json_string(fd, bin->srcfile);
+
+    fprintf(fd, ", \"line\": %u, \"self\": %lld, \"total\": %lld, "
+	    "\"calls\": %llu, \"aborts\": %llu, \"bcode\": %d",
+	    bin->srcline,
+	    bin->sum_self  / timeR_scale,
+	    bin->sum_total / timeR_scale,
+	    bin->starts,
+	    bin->aborts,
+	    bin->bcode);
+
+    if (timeR_alloc_stack != NULL)
+	fprintf(fd, ", \"nodes_self\": %" PRIu64 ", \"nodes_total\": %" PRIu64
+		", \"bytes_self\": %" PRIu64 ", \"bytes_total\": %" PRIu64,
+		bin->nodes_self, bin->nodes_total,
+		bin->bytes_self, bin->bytes_total);
+
+    for (unsigned int i = 0; i < timeR_counter_count; i++)
+	fprintf(fd, ", \"%s_self\": %" PRIu64 ", \"%s_total\": %" PRIu64,
+		counter_names[i], bin->counters != NULL ? bin->counters[2*i]   : 0,
+		counter_names[i], bin->counters != NULL ? bin->counters[2*i+1] : 0);
+
+    if (bin->wall_ns != 0)
+	fprintf(fd, ", \"wall_ns\": %" PRIu64 ", \"cpu_ns\": %" PRIu64,
+		bin->wall_ns, bin->cpu_ns);
+
+    if (bin->hist != NULL)
+	fprintf(fd, ", \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"max\": %lld",
+		hist_percentile(bin, 0.50) / timeR_scale,
+		hist_percentile(bin, 0.90) / timeR_scale,
+		hist_percentile(bin, 0.99) / timeR_scale,
+		bin->max / timeR_scale);
+
+    fputc('}', fd);
+}
+
+/* a JSON array of bins, skipping unused ones like timeR_print_bin */
+static void json_print_bins(FILE *fd, const char *key, tr_bin_t **bins,
+			    unsigned int count, bool force) {
+    bool first = true;
+
+    fprintf(fd, ",\n\"%s\": [", key);
+    for (unsigned int i = 0; i < count; i++) {
+	tr_bin_t *bin = bins[i];
+
+	if ((timeR_reduced_output || bin->successor != 0) && bin->starts == 0 && !force)
+	    continue;
+
+	fputs(first ? "\n" : ",\n", fd);
+	json_print_bin(fd, bin);
+	first = false;
     }
+    fprintf(fd, "\n]");
+}
+
+/* the timers as a JSON object, which is closed by timeR_finish after */
+/* the results of forked children are added                           */
+static void timeR_dump_json(FILE *fd) {
+    struct rusage my_rusage;
+    struct tms    ustimes;
+    long          ticks_per_sec = sysconf(_SC_CLK_TCK);
+    char          strbuf[PATH_MAX+1];
+
+    getrusage(RUSAGE_SELF, &my_rusage);
+    times(&ustimes);
+
+    fprintf(fd, "{\n\"format\": \"timeR\",\n\"version\": 1,\n\"workdir\": ");
+    json_string(fd, getcwd(strbuf, sizeof(strbuf)));
+    fprintf(fd, ",\n\"unit\": \"%ld %s\"", timeR_scale, TIME_R_UNIT);
+    fprintf(fd, ",\n\"sample_rate\": %ld", timeR_sample_rate);
+    fprintf(fd, ",\n\"compensated\": %s", timeR_nested_stack != NULL ? "true" : "false");
+    fprintf(fd, ",\n\"overhead\": {\"small\": %.3f, \"medium\": %.3f, \"deep\": %.3f}",
+	    (timeR_bins[TR_OverheadTest2].sum_self / (double)timeR_bins[TR_OverheadTest2].starts) / timeR_scale,
+	    (timeR_bins[TR_OverheadTest1].sum_self / (double)timeR_bins[TR_OverheadTest1].starts) / timeR_scale,
+	    (deep_overhead / (double)TIME_R_OVERHEAD_DEPTH) / timeR_scale);
+    fprintf(fd, ",\n\"total_runtime\": %ld", (unsigned long)(end_time - start_time));
+    fprintf(fd, ",\n\"start_time_usec\": %ld", start_time_us.tv_sec * 1000000UL + start_time_us.tv_usec);
+    fprintf(fd, ",\n\"end_time_usec\": %ld", end_time_us.tv_sec * 1000000UL + end_time_us.tv_usec);
+    fprintf(fd, ",\n\"user_time\": %f", ustimes.tms_utime / (double)ticks_per_sec);
+    fprintf(fd, ",\n\"system_time\": %f", ustimes.tms_stime / (double)ticks_per_sec);
+    fprintf(fd, ",\n\"max_resident_memory\": %ld", my_rusage.ru_maxrss);
+    if (timeR_trace_file != NULL)
+	fprintf(fd, ",\n\"trace_stalls\": %llu", (unsigned long long)trace_stalls);
+
+    /* same order as the raw output: static, function table and the */
+    /* remaining timers in the order they were created              */
+    unsigned int count = next_bin - TR_HashOverhead;
+    tr_bin_t **binpointers = malloc(sizeof(tr_bin_t *) * count);
+    if (binpointers == NULL)
+	abort();
+
+    for (unsigned int i = 0; i < count; i++)
+	binpointers[i] = timeR_bins + TR_HashOverhead + i;
+
+    json_print_bins(fd, "bins", binpointers, count, false);
 
     free(binpointers);
 }
 
+/* subtract the cost of the measurements from the bins: every measured */
+/* call pays the part of a start/stop cycle between its two clock     */
+/* reads, and every nested timer adds a complete cycle to the total   */
+/* time of its callers, of which all but that part is self time of    */
+/* its direct caller                                                  */
+static void compensate_overhead(void) {
+    if (timeR_nested_stack == NULL)
+	return;
+
+    tr_bin_t *test  = &timeR_bins[TR_OverheadTest2];
+    double    inner = test->starts != 0 ? test->sum_self / (double)test->starts : 0;
+    double    cycle = deep_overhead / (double)TIME_R_OVERHEAD_DEPTH;
+    double    outer = cycle > inner ? cycle - inner : 0;
+
+    /* the overhead tests measure the overhead itself */
+    for (unsigned int i = TR_OverheadTest3 + 1; i < next_bin; i++) {
+	tr_bin_t *bin = timeR_bins + i;
+	timeR_t   self_cost, total_cost;
+
+	self_cost  = (timeR_t)(bin->starts * inner + bin->nested_self * outer);
+	total_cost = (timeR_t)(bin->starts * inner + bin->nested_total * cycle);
+
+	bin->sum_self  = bin->sum_self  > self_cost  ? bin->sum_self  - self_cost  : 0;
+	bin->sum_total = bin->sum_total > total_cost ? bin->sum_total - total_cost : 0;
+
+	/* only compensate once if a child falls back to its own file */
+	bin->nested_self  = 0;
+	bin->nested_total = 0;
+    }
+}
+
+/* extrapolate the measurements of sampled bins to all of their starts */
+static void scale_sampled_bins(void) {
+    for (unsigned int i = 0; i < next_bin; i++) {
+	tr_bin_t *bin = timeR_bins + i;
+
+	if (bin->skipped == 0)
+	    continue;
+
+	if (bin->starts != 0) {
+	    double factor = (double)(bin->starts + bin->skipped) / bin->starts;
+
+	    bin->sum_self  = (timeR_t)(bin->sum_self  * factor);
+	    bin->sum_total = (timeR_t)(bin->sum_total * factor);
+	    bin->aborts    = (unsigned long long)(bin->aborts * factor);
+	    bin->nodes_self  = (uint64_t)(bin->nodes_self  * factor);
+	    bin->nodes_total = (uint64_t)(bin->nodes_total * factor);
+	    bin->bytes_self  = (uint64_t)(bin->bytes_self  * factor);
+	    bin->bytes_total = (uint64_t)(bin->bytes_total * factor);
+
+	    if (bin->counters != NULL)
+		for (unsigned int j = 0; j < 2 * timeR_counter_count; j++)
+		    bin->counters[j] = (uint64_t)(bin->counters[j] * factor);
+	}
+
+	bin->starts += bin->skipped;
+	bin->skipped = 0;
+    }
+}
+
 static void timeR_dump(FILE *fd) {
     // FIXME: Check for errors in fprintfs
     struct rusage my_rusage;
     char strbuf[PATH_MAX+1];
     time_t now;
 
+    if (timeR_output_json) {
+	compensate_overhead();
+	scale_sampled_bins();
+	timeR_dump_json(fd);
+	dump_gc_levels(fd);
+	dump_bcops(fd);
+	return;
+    }
+
     if (getcwd(strbuf, sizeof(strbuf)) != NULL) {
 	fprintf(fd, "Workdir\t%s\n", strbuf);
     }
@@ -503,11 +1002,15 @@ static void timeR_dump(FILE *fd) {
     fprintf(fd, "RusageVolnContextSwitches\t%ld\n", my_rusage.ru_nvcsw);
     fprintf(fd, "RusageInvolnContextSwitches\t%ld\n", my_rusage.ru_nivcsw);
     fprintf(fd, "TimerUnit\t%ld %s\n", timeR_scale, TIME_R_UNIT);
+    fprintf(fd, "SampleRate\t%ld\n", timeR_sample_rate);
+    if (timeR_trace_file != NULL)
+	fprintf(fd, "TraceStalls\t%llu\n", (unsigned long long)trace_stalls);
 
-    fprintf(fd, "#!LABEL\tsmall\tmedium\n");
-    fprintf(fd, "OverheadEstimates\t%.3f\t%.3f\n",
+    fprintf(fd, "#!LABEL\tsmall\tmedium\tdeep\n");
+    fprintf(fd, "OverheadEstimates\t%.3f\t%.3f\t%.3f\n",
 	    (timeR_bins[TR_OverheadTest2].sum_self / (double)timeR_bins[TR_OverheadTest2].starts) / timeR_scale,
-	    (timeR_bins[TR_OverheadTest1].sum_self / (double)timeR_bins[TR_OverheadTest1].starts) / timeR_scale);
+	    (timeR_bins[TR_OverheadTest1].sum_self / (double)timeR_bins[TR_OverheadTest1].starts) / timeR_scale,
+	    (deep_overhead / (double)TIME_R_OVERHEAD_DEPTH) / timeR_scale);
     fprintf(fd, "TotalRuntime\t%ld\n", (unsigned long)(end_time - start_time));
     fprintf(fd, "StartTimeUsec\t%ld\n", start_time_us.tv_sec * 1000000UL + start_time_us.tv_usec);
     fprintf(fd, "EndTimeUsec\t%ld\n", end_time_us.tv_sec * 1000000UL + end_time_us.tv_usec);
@@ -527,142 +1030,528 @@ static void timeR_dump(FILE *fd) {
       }
     }
 
+    compensate_overhead();
+    scale_sampled_bins();
+
     if (timeR_output_raw)
 	timeR_dump_raw(fd);
     else
 	timeR_dump_processed(fd, end_time - start_time);
+
+    dump_cpu_split(fd);
+    dump_gc_levels(fd);
+    dump_bcops(fd);
 }
 
 
-/*** exported functions ***/
+/*** results of forked children ***/
 
-void timeR_init_early(void) {
-    unsigned int i;
+static inline tr_childrec_t *child_record(uint64_t offset) {
+    return (tr_childrec_t *)((char *)(child_shm + 1) + offset);
+}
 
-    /* slightly ugly, but this is called before any part of R is initialized */
-    if (!rtime_check_working()) {
-	fprintf(stderr, "ERROR: The chosen timing method reports that it does not work!\n");
-	exit(2);
-    }
+static inline char *childbin_prefix(tr_childbin_t *cbin) {
+    return cbin->prefix_len != 0 ? (char *)(cbin + 1) : NULL;
+}
 
-    /* allocate the first set of timer blocks */
-    timeR_measureblocks[0] = calloc(TIME_R_MBLOCK_SIZE, sizeof(tr_timer_t));
-    if (timeR_measureblocks[0] == NULL) {
-	fprintf(stderr, "ERROR: Failed to allocate the first block of timers!\n");
-	exit(2);
-    }
+static inline char *childbin_name(tr_childbin_t *cbin) {
+    return (char *)(cbin + 1) + cbin->prefix_len;
+}
 
-    timeR_current_mblock  = timeR_measureblocks[0];
-    timeR_current_mblockidx = 0;
-    timeR_next_mindex = 1; // the very first timer is just a canary
+static inline unsigned int *childbin_hist(tr_childbin_t *cbin) {
+    return (unsigned int *)((char *)(cbin + 1) +
+			    TR_CHILD_ALIGN(cbin->prefix_len + cbin->name_len));
+}
 
-    /* initialize static bins */
-    bin_count = TR_StaticBinCount + TIME_R_INITIAL_EMPTY_BINS;
-    timeR_bins = calloc(bin_count, sizeof(tr_bin_t));
-    if (timeR_bins == NULL) {
-	fprintf(stderr, "ERROR: Failed to allocate the timing bins!\n");
-	exit(2);
-    }
+static size_t childbin_size(const tr_bin_t *bin) {
+    size_t size = sizeof(tr_childbin_t);
 
-    for (i = 0; i < next_bin; i++) {
-	timeR_bins[i].name = bin_names[i];
-    }
+    if (bin->prefix != NULL)
+	size += strlen(bin->prefix) + 1;
+    size = TR_CHILD_ALIGN(size + strlen(bin->name) + 1);
+    if (bin->hist != NULL)
+	size += TR_CHILD_ALIGN(TR_HIST_BUCKETS * sizeof(unsigned int));
 
-    /* add bins for the .Internal/.Primitive functions */
-    /* this happens even when function table timers are disabled */
-    /* to simplify the rest of the code                          */
-    i = 0;
-    while (R_FunTab[i].name != NULL) {
-	// FIXME: BEGIN_PRIMFUN_TIMER and the dump code assume this
-	//        block of fns starts at TR_StaticBinCount
-	unsigned int bin_id = timeR_add_userfn_bin();
+    return size;
+}
 
-	timeR_name_bin(bin_id, R_FunTab[i].name);
+/* copy all used bins of this process into the shared segment, */
+/* returns false if they do not fit                            */
+static bool publish_child_results(void) {
+    compensate_overhead();
+    scale_sampled_bins();
 
-	if ((R_FunTab[i].eval / 10) % 10 == 1) {
-	    // .Internal
-	    timeR_bins[bin_id].prefix = "<.Internal>";
-	} else {
-	    // .Primitive
-	    timeR_bins[bin_id].prefix = "<.Primitive>";
+    uint64_t     size  = sizeof(tr_childrec_t);
+    unsigned int nbins = 0;
+
+    for (unsigned int i = TR_Startup; i < next_bin; i++)
+	if (timeR_bins[i].starts != 0) {
+	    size += childbin_size(&timeR_bins[i]);
+	    nbins++;
 	}
 
-	i++;
+    /* reserve space, records are never moved or freed */
+    uint64_t offset = __atomic_fetch_add(&child_shm->used, size, __ATOMIC_RELAXED);
+    uint64_t limit = TIME_R_CHILD_SHM_SIZE - sizeof(tr_childshm_t);
+    if (offset + size > limit) {
+	/* close the gap up to the end if the record started before it */
+	if (offset + sizeof(tr_childrec_t) <= limit) {
+	    tr_childrec_t *rec = child_record(offset);
+	    __atomic_store_n(&rec->ready, TR_CHILD_OVERFLOWED, __ATOMIC_RELAXED);
+	    __atomic_store_n(&rec->size, limit - offset, __ATOMIC_RELEASE);
+	}
+
+	/* the main process nests the file written instead into its own */
+	uint32_t slot = __atomic_fetch_add(&child_shm->overflows, 1, __ATOMIC_RELAXED);
+	if (slot < TIME_R_MAX_CHILD_OVERFLOWS) {
+	    __atomic_store_n(&child_shm->overflow_pids[slot], getpid(), __ATOMIC_RELEASE);
+	    fprintf(stderr, "WARNING: No room for the results of child %d in shared memory, "
+		    "increase TIME_R_CHILD_SHM_SIZE\n", getpid());
+	} else {
+	    fprintf(stderr, "WARNING: No room for the results of child %d in shared memory, "
+		    "they will not be merged; increase TIME_R_CHILD_SHM_SIZE\n", getpid());
+	}
+	return false;
     }
 
-    first_userfn_idx = i + TR_StaticBinCount;
+    tr_childrec_t *rec = child_record(offset);
+    __atomic_store_n(&rec->size, size, __ATOMIC_RELEASE);
 
-    /* allocate external function map */
-    extfunc_map_length  = TIME_R_EXTFUNC_MAP_STEP;
-    extfunc_map_entries = 0;
+    struct tms ustimes;
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    times(&ustimes);
 
-    extfunc_map = calloc(extfunc_map_length, sizeof(tr_extfunc_entry_t));
-    if (extfunc_map == NULL) {
-	fprintf(stderr, "ERROR: Failed to allocate memory for external function map!\n");
-	exit(2);
+    rec->bins        = nbins;
+    rec->pid         = getpid();
+    rec->parent      = getppid();
+    rec->depth       = fork_depth;
+    rec->runtime     = end_time - start_time;
+    rec->user_time   = ustimes.tms_utime / (double)ticks_per_sec;
+    rec->system_time = ustimes.tms_stime / (double)ticks_per_sec;
+
+    tr_childbin_t *cbin = (tr_childbin_t *)(rec + 1);
+
+    for (unsigned int i = TR_Startup; i < next_bin; i++) {
+	tr_bin_t *bin = &timeR_bins[i];
+
+	if (bin->starts == 0)
+	    continue;
+
+	cbin->size        = childbin_size(bin);
+	cbin->prefix_len  = bin->prefix != NULL ? strlen(bin->prefix) + 1 : 0;
+	cbin->name_len    = strlen(bin->name) + 1;
+	cbin->bcode       = bin->bcode;
+	cbin->has_hist    = bin->hist != NULL;
+	cbin->sum_self    = bin->sum_self;
+	cbin->sum_total   = bin->sum_total;
+	cbin->max         = bin->max;
+	cbin->starts      = bin->starts;
+	cbin->aborts      = bin->aborts;
+	cbin->nodes_self  = bin->nodes_self;
+	cbin->nodes_total = bin->nodes_total;
+	cbin->bytes_self  = bin->bytes_self;
+	cbin->bytes_total = bin->bytes_total;
+	cbin->wall_ns     = bin->wall_ns;
+	cbin->cpu_ns      = bin->cpu_ns;
+
+	if (bin->counters != NULL)
+	    memcpy(cbin->counters, bin->counters,
+		   2 * timeR_counter_count * sizeof(uint64_t));
+
+	if (bin->prefix != NULL)
+	    memcpy(childbin_prefix(cbin), bin->prefix, cbin->prefix_len);
+	memcpy(childbin_name(cbin), bin->name, cbin->name_len);
+	if (bin->hist != NULL)
+	    memcpy(childbin_hist(cbin), bin->hist,
+		   TR_HIST_BUCKETS * sizeof(unsigned int));
+
+	cbin = (tr_childbin_t *)((char *)cbin + cbin->size);
     }
 
-    /* run an overhead test with just a single iteration */
-    BEGIN_TIMER(TR_OverheadTest1);
-    END_TIMER(TR_OverheadTest1);
+    __atomic_store_n(&rec->ready, TR_CHILD_READY, __ATOMIC_RELEASE);
 
-    /* measure the startup time of R */
-    startup_mptr = timeR_begin_timer(TR_Startup);
-    gettimeofday(&start_time_us, NULL);
-    start_time   = tr_now();
+    return true;
 }
 
-void timeR_startup_done(void) {
-    timeR_end_timer(&startup_mptr);
+static int compare_childbins(const void *a_void, const void *b_void) {
+    tr_childbin_t * const *a = a_void;
+    tr_childbin_t * const *b = b_void;
+    const char *pa = childbin_prefix(*a), *pb = childbin_prefix(*b);
 
-    if (timeR_exclude_init) {
-	/* reset all bins */
-	for (unsigned int i = TR_HashOverhead; i < next_bin; i++) {
-	    tr_bin_t *bin = timeR_bins + i;
-
-	    if (bin->name[0] != 0) {
-		bin->sum_self  = 0;
-		bin->sum_total = 0;
-		bin->starts    = 0;
-		bin->aborts    = 0;
-		bin->bcode     = 0;
-	    }
-	}
+    if (pa == NULL || pb == NULL) {
+	if (pa != pb)
+	    return pa == NULL ? -1 : 1;
+    } else {
+	int res = strcmp(pa, pb);
+	if (res != 0)
+	    return res;
+    }
 
-	assert(timeR_current_mblock == timeR_measureblocks[0]); // we shouldn't have many active timers here
+    return strcmp(childbin_name(*a), childbin_name(*b));
+}
 
-	/* reset all stack entries */
-	start_time = tr_now();
+/* register the files of descendants that did not fit into the shared */
+/* segment, so that they are nested like those of a fallback without it */
+static void add_overflowed_childfiles(void) {
+    uint32_t overflows = __atomic_load_n(&child_shm->overflows, __ATOMIC_RELAXED);
+    char     childfn[1024];
 
-	for (unsigned int i = 1; i < timeR_next_mindex; i++) {
-	    timeR_current_mblock[i].start     = start_time;
-	    timeR_current_mblock[i].lower_sum = 0;
-	}
+    if (overflows > TIME_R_MAX_CHILD_OVERFLOWS)
+	overflows = TIME_R_MAX_CHILD_OVERFLOWS;
+    for (uint32_t i = 0; i < overflows; i++) {
+	int32_t pid = __atomic_load_n(&child_shm->overflow_pids[i], __ATOMIC_ACQUIRE);
+
+	if (pid == 0)
+	    continue;
+	snprintf(childfn, sizeof(childfn), "%s_%d", timeR_output_file, (int)pid);
+	add_childfile(childfn);
     }
 }
 
-void timeR_finish(void) {
-    unsigned int i;
+/* list all completed children and their bins, summed up by name */
+static void dump_forked_children(FILE *fd) {
+    uint64_t     used  = __atomic_load_n(&child_shm->used, __ATOMIC_ACQUIRE);
+    uint64_t     limit = TIME_R_CHILD_SHM_SIZE - sizeof(tr_childshm_t);
+    unsigned int children = 0, incomplete = 0, nbins = 0;
+    timeR_t      runtime_sum = 0;
+    uint64_t    *complete = NULL;
+    unsigned int complete_max = 0;
+
+    if (used > limit)
+	used = limit;
+
+    /* first pass: remember the complete records and count their bins, */
+    /* the second pass must not look at records finished in between    */
+    uint64_t offset = 0;
+    while (offset + sizeof(tr_childrec_t) <= used) {
+	tr_childrec_t *rec = child_record(offset);
+	uint64_t size = __atomic_load_n(&rec->size, __ATOMIC_ACQUIRE);
+	uint32_t ready;
+
+	if (size == 0 || offset + size > used) {
+	    /* reserved, but the size is not written yet */
+	    incomplete++;
+	    break;
+	}
 
-    if (timeR_current_mblockidx != 0 || timeR_next_mindex != 1) {
-	/* manually build a mptr to the first timer */
-	tr_measureptr_t fini = {
-	    timeR_measureblocks[0], 1 // timer 0 is a canary value
-	};
+	ready = __atomic_load_n(&rec->ready, __ATOMIC_ACQUIRE);
+	if (ready == TR_CHILD_OVERFLOWED) {
+	    /* counted in overflows */
+	} else if (ready == TR_CHILD_READY) {
+	    if (children == complete_max) {
+		complete_max = complete_max != 0 ? 2 * complete_max : 64;
+		complete = realloc(complete, complete_max * sizeof(uint64_t));
+		if (complete == NULL)
+		    abort();
+	    }
+	    complete[children++] = offset;
+	    nbins += rec->bins;
+	} else {
+	    incomplete++;
+	}
 
-	/* end every remaining timer */
-	timeR_end_timer(&fini);
+	offset += size;
     }
 
-    end_time = tr_now();
+    unsigned int overflows = __atomic_load_n(&child_shm->overflows, __ATOMIC_RELAXED);
+
+    if (children == 0 && incomplete == 0 && overflows == 0) {
+	free(complete);
+	return;
+    }
+
+    if (incomplete != 0)
+	fprintf(stderr, "WARNING: %u forked children did not finish in time\n", incomplete);
+
+    if (timeR_output_json) {
+	fprintf(fd, ",\n\"forked_children\": %u", children);
+	fprintf(fd, ",\n\"forked_incomplete\": %u", incomplete);
+	fprintf(fd, ",\n\"forked_overflow\": %u", overflows);
+	fprintf(fd, ",\n\"forked_processes\": [");
+    } else {
+	fprintf(fd, "ForkedChildren\t%u\n", children);
+	if (incomplete != 0)
+	    fprintf(fd, "ForkedChildrenIncomplete\t%u\n", incomplete);
+	if (overflows != 0)
+	    fprintf(fd, "ForkedChildrenOverflow\t%u\n", overflows);
+	fprintf(fd, "#!LABEL\tpid\tparent\tdepth\truntime\tuser\tsystem\n");
+	fprintf(fd, "#!TABLE\tForkedChild\tForkedChildren\n");
+    }
+
+    tr_childbin_t **cbins = malloc(sizeof(tr_childbin_t *) * (nbins + 1));
+    if (cbins == NULL)
+	abort();
+
+    unsigned int listed = 0;
+    nbins = 0;
+    for (unsigned int c = 0; c < children; c++) {
+	tr_childrec_t *rec = child_record(complete[c]);
+
+	if (timeR_output_json)
+	    fprintf(fd, "%s\n  {\"pid\": %d, \"parent\": %d, \"depth\": %u, "
+		    "\"runtime\": %lld, \"user_time\": %f, \"system_time\": %f}",
+		    listed++ != 0 ? "," : "",
+		    rec->pid, rec->parent, rec->depth,
+		    (long long)(rec->runtime / timeR_scale),
+		    rec->user_time, rec->system_time);
+	else
+	    fprintf(fd, "ForkedChild\t%d\t%d\t%u\t%lld\t%f\t%f\n",
+		    rec->pid, rec->parent, rec->depth,
+		    (long long)(rec->runtime / timeR_scale),
+		    rec->user_time, rec->system_time);
+	runtime_sum += rec->runtime;
+
+	tr_childbin_t *cbin = (tr_childbin_t *)(rec + 1);
+	for (unsigned int i = 0; i < rec->bins; i++) {
+	    cbins[nbins++] = cbin;
+	    cbin = (tr_childbin_t *)((char *)cbin + cbin->size);
+	}
+    }
+
+    /* sum up the bins of all children by name */
+    qsort(cbins, nbins, sizeof(tr_childbin_t *), compare_childbins);
+
+    tr_bin_t  *bins = calloc(nbins + 1, sizeof(tr_bin_t));
+    tr_bin_t **binpointers = malloc(sizeof(tr_bin_t *) * (nbins + 1));
+    if (bins == NULL || binpointers == NULL)
+	abort();
+
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < nbins; i++) {
+	tr_childbin_t *cbin = cbins[i];
+
+	if (i == 0 || compare_childbins(&cbins[i-1], &cbins[i]) != 0) {
+	    binpointers[count] = &bins[count];
+	    bins[count].prefix = childbin_prefix(cbin);
+	    bins[count].name   = childbin_name(cbin);
+	    if (timeR_counter_count != 0) {
+		bins[count].counters = calloc(2 * TIME_R_MAX_COUNTERS, sizeof(uint64_t));
+		if (bins[count].counters == NULL)
+		    abort();
+	    }
+	    count++;
+	}
+
+	tr_bin_t *bin = &bins[count - 1];
+
+	bin->sum_self    += cbin->sum_self;
+	bin->sum_total   += cbin->sum_total;
+	bin->starts      += cbin->starts;
+	bin->aborts      += cbin->aborts;
+	bin->bcode       |= cbin->bcode;
+	bin->nodes_self  += cbin->nodes_self;
+	bin->nodes_total += cbin->nodes_total;
+	bin->bytes_self  += cbin->bytes_self;
+	bin->bytes_total += cbin->bytes_total;
+	bin->wall_ns     += cbin->wall_ns;
+	bin->cpu_ns      += cbin->cpu_ns;
+
+	if (bin->counters != NULL)
+	    for (unsigned int j = 0; j < 2 * timeR_counter_count; j++)
+		bin->counters[j] += cbin->counters[j];
+
+	if (cbin->has_hist) {
+	    unsigned int *hist = childbin_hist(cbin);
+
+	    if (bin->hist == NULL)
+		timeR_hist_alloc(bin);
+	    for (unsigned int j = 0; j < TR_HIST_BUCKETS; j++)
+		bin->hist[j] += hist[j];
+	    if (cbin->max > bin->max)
+		bin->max = cbin->max;
+	}
+    }
+
+    /* print in the same layout as the bins of this process */
+    if (timeR_output_json) {
+	fprintf(fd, "\n]");
+	json_print_bins(fd, "forked", binpointers, count, true);
+    } else if (timeR_output_raw) {
+	fprintf(fd, "#!CHILD\tforked\n");
+	fprintf(fd, "#!LABEL\tself\ttotal\tcalls\taborts\thas_bcode%s%s\n",
+		timeR_alloc_stack != NULL ? ALLOC_LABELS : "", counter_labels);
+	for (unsigned int i = 0; i < count; i++)
+	    timeR_print_bin(fd, binpointers[i], true, 0, false);
+    } else {
+	fprintf(fd, "#!CHILD\tforked\n");
+	qsort(binpointers, count, sizeof(tr_bin_t *), compare_selftime_desc);
+	fprintf(fd, "# --- individual timers\tself_percentage\tself\ttotal\tcalls\taborts\thas_bcode%s%s%s\n",
+		timeR_alloc_stack != NULL ? ALLOC_LABELS : "", counter_labels,
+		timeR_histograms ? "\tp50\tp90\tp99\tmax" : "");
+	for (unsigned int i = 0; i < count; i++)
+	    timeR_print_bin(fd, binpointers[i], true,
+			    runtime_sum != 0 ? runtime_sum : 1, timeR_histograms);
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+	free(bins[i].hist);
+	free(bins[i].counters);
+    }
+    free(bins);
+    free(binpointers);
+    free(cbins);
+    free(complete);
+}
+
+
+/*** exported functions ***/
+
+void timeR_init_early(void) {
+    unsigned int i;
+
+    /* slightly ugly, but this is called before any part of R is initialized */
+    if (!rtime_check_working()) {
+	fprintf(stderr, "ERROR: The chosen timing method reports that it does not work!\n");
+	exit(2);
+    }
+
+    /* reserve the timer stack, pages are only committed when touched */
+    timeR_stack = mmap(NULL, TIME_R_STACK_ENTRIES * sizeof(tr_timer_t),
+		       PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (timeR_stack == MAP_FAILED) {
+	fprintf(stderr, "ERROR: Failed to reserve the timer stack!\n");
+	exit(2);
+    }
+
+    timeR_stack_top   = timeR_stack + 1;
+    timeR_stack_limit = timeR_stack + TIME_R_STACK_ENTRIES;
+
+    /* all compiled-in timers are enabled at run-time unless deselected */
+    memset(timeR_static_enabled, 1, sizeof(timeR_static_enabled));
+
+    char *envsel = getenv("R_TIMER_DISABLE");
+    if (envsel != NULL)
+	timeR_select_timers(envsel, 0);
+
+    envsel = getenv("R_TIMER_ENABLE");
+    if (envsel != NULL)
+	timeR_select_timers(envsel, 1);
+
+    /* initialize static bins */
+    bin_count = TR_StaticBinCount + TIME_R_INITIAL_EMPTY_BINS;
+    timeR_bins = calloc(bin_count, sizeof(tr_bin_t));
+    if (timeR_bins == NULL) {
+	fprintf(stderr, "ERROR: Failed to allocate the timing bins!\n");
+	exit(2);
+    }
+
+    for (i = 0; i < next_bin; i++) {
+	timeR_bins[i].name = bin_names[i];
+    }
+
+    /* add bins for the .Internal/.Primitive functions */
+    /* this happens even when function table timers are disabled */
+    /* to simplify the rest of the code                          */
+    i = 0;
+    while (R_FunTab[i].name != NULL) {
+	// FIXME: BEGIN_PRIMFUN_TIMER and the dump code assume this
+	//        block of fns starts at TR_StaticBinCount
+	unsigned int bin_id = timeR_add_userfn_bin();
+
+	timeR_name_bin(bin_id, R_FunTab[i].name);
+
+	if ((R_FunTab[i].eval / 10) % 10 == 1) {
+	    // .Internal
+	    timeR_bins[bin_id].prefix = "<.Internal>";
+	} else {
+	    // .Primitive
+	    timeR_bins[bin_id].prefix = "<.Primitive>";
+	}
+
+	i++;
+    }
+
+    first_userfn_idx = i + TR_StaticBinCount;
+
+    /* allocate external function map */
+    extfunc_map_length  = TIME_R_EXTFUNC_MAP_INITIAL;
+    extfunc_map_entries = 0;
+
+    extfunc_map = calloc(extfunc_map_length, sizeof(tr_extfunc_entry_t));
+    if (extfunc_map == NULL) {
+	fprintf(stderr, "ERROR: Failed to allocate memory for external function map!\n");
+	exit(2);
+    }
+
+    /* allocate bin name map */
+    bin_map_length  = TIME_R_BIN_MAP_INITIAL;
+    bin_map_entries = 0;
+
+    bin_map = calloc(bin_map_length, sizeof(unsigned int));
+    if (bin_map == NULL) {
+	fprintf(stderr, "ERROR: Failed to allocate memory for bin name map!\n");
+	exit(2);
+    }
+
+    /* run an overhead test with just a single iteration */
+    BEGIN_TIMER(TR_OverheadTest1);
+    END_TIMER(TR_OverheadTest1);
+
+    /* measure the startup time of R */
+    startup_mptr = timeR_begin_timer(TR_Startup);
+    gettimeofday(&start_time_us, NULL);
+    start_time   = tr_now();
+    timeR_bcop_start = start_time;
+}
+
+void timeR_startup_done(void) {
+    timeR_end_timer(&startup_mptr);
+
+    /* reserve the segment for the results of forked children, */
+    /* pages are only committed when touched                    */
+    if (timeR_output_file != NULL) {
+	child_shm = mmap(NULL, TIME_R_CHILD_SHM_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (child_shm == MAP_FAILED) {
+	    fprintf(stderr, "WARNING: Failed to reserve the shared memory for child results, "
+		    "falling back to files\n");
+	    child_shm = NULL;
+	}
+    }
+
+    if (timeR_exclude_init)
+	timeR_reset_all();
+}
+
+void timeR_finish(void) {
+    unsigned int i;
+
+    if (timeR_stack_top != timeR_stack + 1) {
+	/* manually build a mptr to the first timer */
+	tr_measureptr_t fini = {
+	    timeR_stack + 1 // timer 0 is a canary value
+	};
+
+	/* end every remaining timer */
+	timeR_end_timer(&fini);
+    }
+
+    end_time = tr_now();
     gettimeofday(&end_time_us, NULL);
 
+    trace_finish();
+
     /* run a second overhead test with a large number of iterations */
     for (i = 0; i < 1000; i++) {
 	BEGIN_TIMER(TR_OverheadTest2);
 	END_TIMER(TR_OverheadTest2);
     }
 
+    /* measure complete start/stop cycles of deeply nested timers, */
+    /* without the call tree which would run out of nodes           */
+    tr_ctnode_t *ctnodes = timeR_ctnodes;
+    timeR_ctnodes = NULL;
+
+    deep_overhead = tr_now();
+    for (i = 0; i < TIME_R_OVERHEAD_DEPTH; i++)
+	timeR_begin_timer(TR_OverheadTest3);
+    for (i = 0; i < TIME_R_OVERHEAD_DEPTH; i++)
+	timeR_end_latest_timer(tr_now());
+    deep_overhead = tr_now() - deep_overhead;
+
+    timeR_ctnodes = ctnodes;
+
     /* dump data to file */
     FILE *fd;
 
@@ -671,7 +1560,27 @@ void timeR_finish(void) {
 
     char str[1024];
 
-    if (R_isForkedChild) {
+    /* write the call tree first */
+    if (timeR_ctnodes != NULL && timeR_calltree_file != NULL) {
+	if (R_isForkedChild)
+	    snprintf(str, 1023, "%s_%d", timeR_calltree_file, getpid());
+	else
+	    snprintf(str, 1023, "%s", timeR_calltree_file);
+
+	FILE *ctfd = fopen(str, "w");
+	if (ctfd != NULL) {
+	    timeR_dump_calltree(ctfd);
+	    fclose(ctfd);
+	} else {
+	    fprintf(stderr, "WARNING: Unable to open %s: %s\n", str, strerror(errno));
+	}
+    }
+
+    /* forked children hand their bins to the main process */
+    if (fork_depth > 0 && child_shm != NULL && publish_child_results())
+	return;
+
+    if (fork_depth > 0) {
       snprintf(str, 1023, "%s_%d", timeR_output_file, getpid());
     } else {
       strcpy(str, timeR_output_file);
@@ -682,10 +1591,32 @@ void timeR_finish(void) {
 	return;
 
     timeR_dump(fd);
+    dump_threads(fd);
+
+    if (fork_depth == 0 && child_shm != NULL) {
+	dump_forked_children(fd);
+	add_overflowed_childfiles();
+    }
+
+    /* skip children that wrote no file, e.g. because they are still */
+    /* running or handed their results over in shared memory         */
+    unsigned int existing = 0;
+    for (unsigned int i = 0; i < childfiles_count; i++) {
+      if (access(childfiles[i], F_OK) == 0)
+        childfiles[existing++] = childfiles[i];
+      else
+        free(childfiles[i]);
+    }
+    childfiles_count = existing;
 
     /* if on parent: combine all child summary files */
     if (childfiles_count) {
-      fprintf(fd, "childcount\t%d\n", childfiles_count);
+      unsigned int copied = 0;
+
+      if (timeR_output_json)
+        fprintf(fd, ",\n\"children\": [\n");
+      else
+        fprintf(fd, "childcount\t%d\n", childfiles_count);
       for (unsigned int i = 0; i < childfiles_count; i++) {
         FILE *childfd = fopen(childfiles[i], "r");
         if (!childfd) {
@@ -693,276 +1624,1224 @@ void timeR_finish(void) {
           continue;
         }
 
-        unlink(childfiles[i]);
+        unlink(childfiles[i]);
+
+        /* the files of the children are complete JSON objects */
+        if (!timeR_output_json)
+          fprintf(fd, "#!CHILD\t%d\n", i+1);
+        else if (copied != 0)
+          fprintf(fd, ",\n");
+        copied++;
+
+        while (fgets(str, sizeof(str), childfd)) {
+          fprintf(fd, "%s", str);
+        }
+
+        fclose(childfd);
+      }
+      if (timeR_output_json)
+        fprintf(fd, "]");
+    }
+
+    if (timeR_output_json)
+      fprintf(fd, "\n}\n");
+
+    // FIXME: Check for errors
+    fclose(fd);
+}
+
+tr_measureptr_t timeR_stack_full(void) {
+    /* threads that did not call timeR_thread_begin have no stack and */
+    /* no bins, their timers are not measured                         */
+    if (timeR_stack == NULL) {
+        tr_measureptr_t none = { NULL };
+        return none;
+    }
+
+    /* abort here - the stack can't be moved because all existing */
+    /* tr_measureptr_t point into it                               */
+    fprintf(stderr, "ERROR: Too many nested timers!\n"
+            "increase TIME_R_STACK_ENTRIES and recompile\n");
+    abort();
+}
+
+void timeR_end_timers_slowpath(const tr_measureptr_t *mptr, timeR_t when) {
+    /* loop until the passed timer has been processed */
+    do {
+	timeR_end_latest_timer(when);
+
+	/* update abort counter if this isn't the top timer */
+	if (timeR_stack_top != mptr->timer)
+            timeR_bins[timeR_stack_top->bin_id].aborts++;
+
+    } while (timeR_stack_top != mptr->timer);
+}
+
+unsigned int timeR_add_userfn_bin(void) {
+    /* check if there are bins available */
+    if (next_bin >= bin_count) {
+	/* grow by half, so packages with many functions don't realloc */
+	/* the whole array over and over                               */
+	unsigned int grow = bin_count / 2;
+	if (grow < TIME_R_REALLOC_BINS)
+	    grow = TIME_R_REALLOC_BINS;
+
+	tr_bin_t *newbins =
+	    realloc(timeR_bins, (bin_count + grow) * sizeof(tr_bin_t));
+
+	if (newbins == NULL)
+	    /* realloc failed, return the fallback */
+	    return TR_UserFuncFallback;
+
+	/* clear the new entries */
+	memset(newbins + bin_count, 0, sizeof(tr_bin_t) * grow);
+
+	/* update bookkeeping */
+	timeR_bins = newbins;
+	bin_count += grow;
+    }
+
+    return next_bin++;
+}
+
+void timeR_hist_alloc(tr_bin_t *bin) {
+    bin->hist = calloc(TR_HIST_BUCKETS, sizeof(unsigned int));
+    if (bin->hist == NULL) {
+	fprintf(stderr, "ERROR: Failed to allocate timer histogram!\n");
+	exit(2);
+    }
+}
+
+void timeR_name_bin(unsigned int bin_id, const char *name) {
+    /* create permanent copy of name */
+    char *copy = strdup(name);
+    if (!copy)
+        copy = userfunc_unknown_str;
+
+    if (timeR_bins[bin_id].name != NULL)
+        free(timeR_bins[bin_id].name);
+
+    timeR_bins[bin_id].name = copy;
+}
+
+/* enable or disable a comma-separated list of timers at run-time    */
+/* entries are static timer names, static timer groups (source file  */
+/* names without ".c") or one of the categories "static", "funtab",  */
+/* "userfunc", "external" and "all"; returns the number of unknown   */
+/* entries                                                           */
+int timeR_select_timers(const char *list, int state) {
+    char *copy = strdup(list);
+    char *saveptr;
+    int   unknown = 0;
+
+    if (copy == NULL)
+	return 1;
+
+    state = !!state;
+
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+	 tok = strtok_r(NULL, ",", &saveptr)) {
+	bool found = false;
+	bool all   = !strcmp(tok, "all");
+
+	if (all || !strcmp(tok, "funtab")) {
+	    timeR_funtab_enabled = state;
+	    found = true;
+	}
+
+	if (all || !strcmp(tok, "userfunc")) {
+	    timeR_userfunc_enabled = state;
+	    found = true;
+	}
+
+	if (all || !strcmp(tok, "external")) {
+	    timeR_extfunc_enabled = state;
+	    found = true;
+	}
+
+	if (all || !strcmp(tok, "bcops")) {
+	    timeR_bcops_enabled = state;
+	    found = true;
+	}
+
+	/* static timers by name, group or as a whole */
+	for (unsigned int i = 0; i < TR_StaticBinCount; i++) {
+	    if (all || !strcmp(tok, "static") ||
+		!strcmp(tok, bin_names[i]) || !strcmp(tok, timer_groups[i])) {
+		found = true;
+
+		/* the overhead tests and Startup are always measured */
+		if (i >= TR_HashOverhead && i != TR_Startup)
+		    timeR_static_enabled[i] = state;
+	    }
+	}
+
+	if (!found) {
+	    fprintf(stderr, "WARNING: unknown timeR timer or group '%s' ignored\n", tok);
+	    unknown++;
+	}
+    }
+
+    free(copy);
+    return unknown;
+}
+
+/* remember where the R code of a bin is defined, consecutive bins */
+/* mostly come from the same file, so its name is only copied once  */
+static void set_bin_source(unsigned int bin_id, const char *filename,
+                           unsigned int line, unsigned int col) {
+  static char *last_file;
+
+  if (last_file == NULL || strcmp(last_file, filename)) {
+    char *copy = strdup(filename);
+    if (copy == NULL)
+      return;
+    last_file = copy;
+  }
+
+  timeR_bins[bin_id].srcfile = last_file;
+  timeR_bins[bin_id].srcline = line;
+  timeR_bins[bin_id].srccol  = col;
+}
+
+static inline bool same_string(const char *a, const char *b) {
+  return a == b || (a != NULL && b != NULL && !strcmp(a, b));
+}
+
+/* FNV-1a over the name, the file is mostly part of it anyway */
+static unsigned int hash_bin_key(const char *name) {
+  uint32_t h = 2166136261u;
+
+  for (const unsigned char *c = (const unsigned char *)name; *c != 0; c++)
+    h = (h ^ *c) * 16777619u;
+
+  return h;
+}
+
+static bool bin_has_key(const tr_bin_t *bin, const char *prefix,
+                        const char *file, const char *name) {
+  return !strcmp(bin->name, name) && same_string(bin->prefix, prefix) &&
+         same_string(bin->srcfile, file);
+}
+
+/* insert a bin into the map, which must have a free slot */
+static void insert_bin(unsigned int *map, unsigned int length,
+                       unsigned int bin_id) {
+  tr_bin_t    *bin = &timeR_bins[bin_id];
+  unsigned int i   = hash_bin_key(bin->name) & (length - 1);
+
+  /* linear probing */
+  while (map[i] != 0)
+    i = (i + 1) & (length - 1);
+
+  map[i] = bin_id;
+}
+
+/* double the size of the map */
+static void grow_bin_map(void) {
+  unsigned int  newlength = 2 * bin_map_length;
+  unsigned int *newmap    = calloc(newlength, sizeof(unsigned int));
+
+  if (newmap == NULL)
+    abort();
+
+  for (unsigned int i = 0; i < bin_map_length; i++)
+    if (bin_map[i] != 0)
+      insert_bin(newmap, newlength, bin_map[i]);
+
+  free(bin_map);
+  bin_map        = newmap;
+  bin_map_length = newlength;
+}
+
+/* look up the bin of a file and name, add if not found; the position */
+/* of the first definition is kept for the output                     */
+static unsigned int intern_bin(const char *prefix, const char *file,
+                               unsigned int line, unsigned int col,
+                               const char *name) {
+  unsigned int i = hash_bin_key(name) & (bin_map_length - 1);
+
+  while (bin_map[i] != 0) {
+    if (bin_has_key(&timeR_bins[bin_map[i]], prefix, file, name))
+      return bin_map[i];
+
+    i = (i + 1) & (bin_map_length - 1);
+  }
+
+  /* not found, create a new bin */
+  unsigned int bin_id = timeR_add_userfn_bin();
+  if (bin_id == TR_UserFuncFallback)
+    return bin_id;
+
+  timeR_name_bin(bin_id, name);
+  timeR_bins[bin_id].prefix = (char *)prefix;
+  if (file != NULL)
+    set_bin_source(bin_id, file, line, col);
+
+  /* keep the load factor below 1/2 */
+  if (2 * (bin_map_entries + 1) > bin_map_length)
+    grow_bin_map();
+
+  insert_bin(bin_map, bin_map_length, bin_id);
+  bin_map_entries++;
+
+  return bin_id;
+}
+
+/* the bin that replaced a renamed one; only current bins become */
+/* successors, so the chains have no cycles                       */
+static unsigned int current_bin(unsigned int bin_id) {
+  unsigned int cur = bin_id;
+
+  while (timeR_bins[cur].successor != 0)
+    cur = timeR_bins[cur].successor;
+
+  /* shorten the chain for the next lookup */
+  if (cur != bin_id)
+    timeR_bins[bin_id].successor = cur;
+
+  return cur;
+}
+
+/* bin of a named user function, shared by all definitions of the */
+/* name in the file                                              */
+unsigned int timeR_userfn_bin(const char *file, unsigned int line,
+                              unsigned int pos, const char *name) {
+  return current_bin(intern_bin(NULL, file, line, pos, name));
+}
+
+/* bin of an anonymous function defined at the given position */
+unsigned int timeR_anonfunc_bin(const char *file, unsigned int line,
+                                unsigned int pos) {
+  char nametmp[1024];
+
+  nametmp[sizeof(nametmp) - 1] = 0;
+  snprintf(nametmp, sizeof(nametmp), "%s:<anon function defined in line %d column %d>",
+           file, line, pos);
+
+  unsigned int bin_id = intern_bin(NULL, file, line, pos, nametmp);
+  if (bin_id != TR_UserFuncFallback)
+    timeR_bins[bin_id].anon = 1;
+
+  return current_bin(bin_id);
+}
+
+/* bin of a function once its name is known, e.g. from the parser or */
+/* an assignment; the old bin stays in the map and points to the new  */
+/* one, so code that is parsed or loaded again goes straight to the   */
+/* new bin, and is left out of the output unless it was used          */
+unsigned int timeR_rename_bin(unsigned int bin_id, const char *name) {
+  /* the fallback and bins without a source position stay as they are */
+  if (bin_id < first_userfn_idx)
+    return bin_id;
+
+  /* intern_bin may realloc the bins, no pointers to them here */
+  unsigned int new_id = current_bin(intern_bin(NULL, timeR_bins[bin_id].srcfile,
+                                               timeR_bins[bin_id].srcline,
+                                               timeR_bins[bin_id].srccol, name));
+
+  if (new_id == TR_UserFuncFallback)
+    return bin_id;
+
+  if (new_id != bin_id)
+    timeR_bins[bin_id].successor = new_id;
+
+  return new_id;
+}
+
+/* bin for a statement in a braced expression list, 0 if there is */
+/* no room left                                                   */
+unsigned int timeR_line_bin(const char *file, unsigned int line) {
+  char nametmp[1024];
+
+  nametmp[sizeof(nametmp) - 1] = 0;
+  snprintf(nametmp, sizeof(nametmp), "%s:line %d", file, line);
+
+  unsigned int bin_id = intern_bin(NULL, file, line, 0, nametmp);
+
+  /* don't let statements end up in the function fallback bin */
+  return bin_id != TR_UserFuncFallback ? bin_id : 0;
+}
+
+/* names of the byte-code instructions, called once by eval.c */
+void timeR_bcops_setup(const char * const *names, unsigned int count) {
+  if (count > TIME_R_MAX_BCOPS) {
+    fprintf(stderr, "ERROR: Too many byte-code instructions!\n"
+            "increase TIME_R_MAX_BCOPS and recompile\n");
+    exit(2);
+  }
+
+  memcpy(bcop_names, names, count * sizeof(const char *));
+  bcop_count = count;
+}
+
+/* explicitly stop timers if a SETJMP returns */
+/* This function is not inlined because it is assumed that */
+/* it will only rarely be called.                          */
+void timeR_release(tr_measureptr_t *marker, unsigned int bcop) {
+    /* charge the byte-code instructions from here on to the one */
+    /* that ran when the marker was set                          */
+    if (timeR_bcops_enabled && timeR_bcop_current != bcop)
+        timeR_bcop_switch(bcop);
+
+    /* check if anything needs to be done at all */
+    if (marker->timer == timeR_stack_top)
+        return;
+
+    /* marker points to an allocated measurement, end it */
+    timeR_end_timer(marker);
+}
+
+/* debug aid: dump the current timer stack to stderr */
+void timeR_dump_timer_stack(void) {
+    fprintf(stderr,"--- current timer stack:\n");
+
+    for (tr_timer_t *m = timeR_stack + 1; m < timeR_stack_top; m++)
+	fprintf(stderr, "%3d: %3d (%s)\n", (int)(m - timeR_stack - 1),
+		m->bin_id, timeR_bins[m->bin_id].name);
+}
+
+
+/*** allocation accounting ***/
+
+/* enable allocation accounting, called after --timeR-memory is parsed */
+void timeR_alloc_setup(void) {
+    if (timeR_alloc_stack != NULL)
+	return;
+
+    /* same layout as the timer stack, committed on first use */
+    tr_alloc_t *stack = mmap(NULL, TIME_R_STACK_ENTRIES * sizeof(tr_alloc_t),
+			     PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) {
+	fprintf(stderr, "WARNING: Failed to reserve the allocation stack!\n");
+	return;
+    }
+
+    /* timers that are already running count from now on */
+    for (tr_timer_t *m = timeR_stack + 1; m < timeR_stack_top; m++) {
+	stack[m - timeR_stack].nodes_start = timeR_alloc_nodes;
+	stack[m - timeR_stack].bytes_start = timeR_alloc_bytes;
+    }
+
+    timeR_alloc_stack = stack;
+}
+
+
+/*** overhead compensation ***/
+
+/* count nested timers for compensate_overhead, called after */
+/* --timeR-compensate is parsed                              */
+void timeR_compensate_setup(void) {
+    if (timeR_nested_stack != NULL)
+	return;
+
+    /* same layout as the timer stack, committed on first use */
+    tr_nested_t *stack = mmap(NULL, TIME_R_STACK_ENTRIES * sizeof(tr_nested_t),
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) {
+	fprintf(stderr, "WARNING: Failed to reserve the nested timer stack!\n");
+	return;
+    }
+
+    /* timers that are already running count from now on, as if they */
+    /* were the last one started (the counter wraps around if it is 0) */
+    for (tr_timer_t *m = timeR_stack + 1; m < timeR_stack_top; m++)
+	stack[m - timeR_stack].starts_start = timeR_nested_starts - 1;
+
+    timeR_nested_stack = stack;
+}
+
+
+/*** performance counters ***/
+
+#ifdef __linux__
+
+typedef struct {
+    uint64_t start[TIME_R_MAX_COUNTERS];  /* counter values when the timer started */
+    uint64_t lower[TIME_R_MAX_COUNTERS];  /* counts of "called" timers */
+} tr_counterframe_t;
+
+static const struct {
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+} counter_types[] = {
+    { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    { "cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branches",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branch-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "task-clock",       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { NULL, 0, 0 }
+};
+
+static unsigned int       counter_type[TIME_R_MAX_COUNTERS]; // index into counter_types
+static int                counter_fd[TIME_R_MAX_COUNTERS];
+static struct perf_event_mmap_page *counter_page[TIME_R_MAX_COUNTERS];
+static uint64_t           counter_last[TIME_R_MAX_COUNTERS];
+static uint64_t           counter_lower[TIME_R_MAX_COUNTERS];
+static tr_counterframe_t *counter_stack;
+
+static void close_counters(unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+	if (counter_page[i] != NULL)
+	    munmap(counter_page[i], sysconf(_SC_PAGESIZE));
+	close(counter_fd[i]);
+	counter_page[i] = NULL;
+    }
+}
+
+static bool open_counters(unsigned int count) {
+    struct perf_event_attr attr;
+
+    for (unsigned int i = 0; i < count; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size           = sizeof(attr);
+	attr.type           = counter_types[counter_type[i]].type;
+	attr.config         = counter_types[counter_type[i]].config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+
+	counter_fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (counter_fd[i] < 0) {
+	    fprintf(stderr, "WARNING: Unable to open performance counter %s: %s\n",
+		    counter_types[counter_type[i]].name, strerror(errno));
+	    close_counters(i);
+	    return false;
+	}
+
+	/* the mapped page allows reading hardware counters with rdpmc */
+	counter_page[i] = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ,
+			       MAP_SHARED, counter_fd[i], 0);
+	if (counter_page[i] == MAP_FAILED)
+	    counter_page[i] = NULL;
+
+	counter_last[i] = 0;
+    }
+
+    return true;
+}
+
+static uint64_t read_counter(unsigned int i) {
+#if defined(__x86_64__) || defined(__i386__)
+    struct perf_event_mmap_page *pc = counter_page[i];
+
+    if (pc != NULL && pc->cap_user_rdpmc) {
+	uint32_t seq, idx;
+	uint64_t count;
+
+	/* see the description of perf_event_mmap_page in perf_event.h */
+	do {
+	    seq = pc->lock;
+	    __sync_synchronize();
+
+	    idx   = pc->index;
+	    count = pc->offset;
+	    if (idx != 0) {
+		uint32_t lo, hi;
+		__asm__ volatile("rdpmc" : "=a" (lo), "=d" (hi) : "c" (idx - 1));
+
+		int64_t pmc = ((uint64_t)hi << 32) | lo;
+		pmc <<= 64 - pc->pmc_width;
+		pmc >>= 64 - pc->pmc_width;
+		count += pmc;
+	    }
+
+	    __sync_synchronize();
+	} while (pc->lock != seq);
+
+	if (idx != 0)
+	    return count;
+    }
+#endif
+
+    /* software counters and counters that are not scheduled right now */
+    uint64_t value;
+    if (read(counter_fd[i], &value, sizeof(value)) == sizeof(value))
+	counter_last[i] = value;
+
+    return counter_last[i];
+}
+
+void timeR_counters_enter(tr_timer_t *m) {
+    tr_counterframe_t *f = &counter_stack[m - timeR_stack];
+
+    for (unsigned int i = 0; i < timeR_counter_count; i++) {
+	f->start[i]      = read_counter(i);
+	f->lower[i]      = counter_lower[i];
+	counter_lower[i] = 0;
+    }
+}
+
+void timeR_counters_exit(tr_timer_t *m, tr_bin_t *bin) {
+    tr_counterframe_t *f = &counter_stack[m - timeR_stack];
+
+    if (bin->counters == NULL) {
+	bin->counters = calloc(2 * TIME_R_MAX_COUNTERS, sizeof(uint64_t));
+	if (bin->counters == NULL) {
+	    fprintf(stderr, "ERROR: Failed to allocate performance counter sums!\n");
+	    exit(2);
+	}
+    }
+
+    for (unsigned int i = 0; i < timeR_counter_count; i++) {
+	uint64_t diff = read_counter(i) - f->start[i];
+
+	bin->counters[2*i+1] += diff;
+	if (diff >= counter_lower[i])
+	    bin->counters[2*i] += diff - counter_lower[i];
+	counter_lower[i] = f->lower[i] + diff;
+    }
+}
+
+/* let all running timers count from now on */
+static void reset_counters(void) {
+    if (timeR_counter_count == 0)
+	return;
+
+    for (tr_timer_t *m = timeR_stack + 1; m < timeR_stack_top; m++) {
+	tr_counterframe_t *f = &counter_stack[m - timeR_stack];
+
+	for (unsigned int i = 0; i < timeR_counter_count; i++) {
+	    f->start[i] = read_counter(i);
+	    f->lower[i] = 0;
+	}
+    }
+
+    memset(counter_lower, 0, sizeof(counter_lower));
+}
+
+static void reopen_counters(void) {
+    if (timeR_counter_count == 0)
+	return;
+
+    close_counters(timeR_counter_count);
+    if (!open_counters(timeR_counter_count))
+	timeR_counter_count = 0;
+}
+
+/* enable the comma-separated list of counters given to --timeR-counters */
+int timeR_counters_setup(const char *list) {
+    unsigned int count = 0;
+    char        *copy  = strdup(list);
+    char        *saveptr;
+
+    if (copy == NULL || timeR_counter_count != 0) {
+	free(copy);
+	return 0;
+    }
+
+    counter_labels[0] = 0;
+
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+	 tok = strtok_r(NULL, ",", &saveptr)) {
+	unsigned int t;
+
+	for (t = 0; counter_types[t].name != NULL; t++)
+	    if (!strcmp(tok, counter_types[t].name))
+		break;
+
+	if (counter_types[t].name == NULL) {
+	    fprintf(stderr, "WARNING: Unknown performance counter %s\n", tok);
+	    continue;
+	}
+
+	if (count == TIME_R_MAX_COUNTERS) {
+	    fprintf(stderr, "WARNING: Too many performance counters, ignoring %s\n", tok);
+	    continue;
+	}
+
+	counter_names[count] = counter_types[t].name;
+	counter_type[count++] = t;
+	snprintf(counter_labels + strlen(counter_labels),
+		 sizeof(counter_labels) - strlen(counter_labels),
+		 "\t%s_self\t%s_total", tok, tok);
+    }
+
+    free(copy);
+
+    if (count == 0 || !open_counters(count)) {
+	counter_labels[0] = 0;
+	return 0;
+    }
+
+    /* same layout as the timer stack, committed on first use */
+    counter_stack = mmap(NULL, TIME_R_STACK_ENTRIES * sizeof(tr_counterframe_t),
+			 PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (counter_stack == MAP_FAILED) {
+	fprintf(stderr, "WARNING: Failed to reserve the performance counter stack!\n");
+	close_counters(count);
+	counter_labels[0] = 0;
+	return 0;
+    }
+
+    timeR_counter_count = count;
+    reset_counters();
+
+    return 1;
+}
+
+#else // __linux__
+
+/* perf_event_open is only available on Linux */
+void timeR_counters_enter(tr_timer_t *m) {}
+void timeR_counters_exit(tr_timer_t *m, tr_bin_t *bin) {}
+static void reset_counters(void) {}
+static void reopen_counters(void) {}
+
+int timeR_counters_setup(const char *list) {
+    fprintf(stderr, "WARNING: Performance counters are not supported on this platform\n");
+    return 0;
+}
+
+#endif // __linux__
+
+
+/*** call tree ***/
+
+static unsigned int ctnode_hash_slot(unsigned int parent, unsigned int bin_id) {
+    return ((parent * 2654435761u) ^ (bin_id * 40503u)) & (ctnode_hash_size - 1);
+}
+
+/* grow the node array and rebuild the hash table, false if at the limit */
+static bool grow_calltree(void) {
+    unsigned int newmax = ctnode_max * 2;
+
+    if (ctnode_max >= timeR_calltree_max)
+	return false;
+    if (newmax > timeR_calltree_max)
+	newmax = timeR_calltree_max;
+
+    /* keep the hash table at most half full */
+    unsigned int newhashsize = ctnode_hash_size;
+    while (newhashsize < 2 * newmax)
+	newhashsize *= 2;
+
+    tr_ctnode_t  *newnodes = realloc(timeR_ctnodes, newmax * sizeof(tr_ctnode_t));
+    unsigned int *newhash  = calloc(newhashsize, sizeof(unsigned int));
+    if (newnodes == NULL || newhash == NULL) {
+	/* keep working with the current nodes */
+	if (newnodes != NULL)
+	    timeR_ctnodes = newnodes;
+	free(newhash);
+	return false;
+    }
+
+    timeR_ctnodes = newnodes;
+    ctnode_max    = newmax;
+
+    free(ctnode_hash);
+    ctnode_hash      = newhash;
+    ctnode_hash_size = newhashsize;
+    for (unsigned int i = CT_OVERFLOW + 1; i < ctnode_count; i++) {
+	unsigned int slot = ctnode_hash_slot(timeR_ctnodes[i].parent,
+					     timeR_ctnodes[i].bin_id);
+	while (ctnode_hash[slot] != 0)
+	    slot = (slot + 1) & (ctnode_hash_size - 1);
+	ctnode_hash[slot] = i;
+    }
+
+    return true;
+}
+
+/* find or create the node for bin_id called from parent */
+static unsigned int lookupadd_ctnode(unsigned int parent, unsigned int bin_id) {
+    if (parent == CT_OVERFLOW)
+	return CT_OVERFLOW;
+
+    unsigned int slot = ctnode_hash_slot(parent, bin_id);
+    while (ctnode_hash[slot] != 0) {
+	tr_ctnode_t *node = &timeR_ctnodes[ctnode_hash[slot]];
+
+	if (node->parent == parent && node->bin_id == bin_id)
+	    return ctnode_hash[slot];
+
+	slot = (slot + 1) & (ctnode_hash_size - 1);
+    }
+
+    if (ctnode_count >= timeR_calltree_max) {
+	ctnode_dropped++;
+	return CT_OVERFLOW;
+    }
+
+    if (ctnode_count >= ctnode_max) {
+	if (!grow_calltree()) {
+	    ctnode_dropped++;
+	    return CT_OVERFLOW;
+	}
+
+	/* the table was rebuilt, find a new free slot */
+	slot = ctnode_hash_slot(parent, bin_id);
+	while (ctnode_hash[slot] != 0)
+	    slot = (slot + 1) & (ctnode_hash_size - 1);
+    }
+
+    unsigned int idx = ctnode_count++;
+    memset(&timeR_ctnodes[idx], 0, sizeof(tr_ctnode_t));
+    timeR_ctnodes[idx].parent = parent;
+    timeR_ctnodes[idx].bin_id = bin_id;
+    ctnode_hash[slot] = idx;
+
+    return idx;
+}
+
+/* enable the call tree, called after --timeR-calltree is parsed */
+void timeR_calltree_setup(void) {
+    if (timeR_ctnodes != NULL)
+	return;
+
+    ctnode_max       = TIME_R_CALLTREE_INITIAL_NODES;
+    ctnode_hash_size = 2 * TIME_R_CALLTREE_INITIAL_NODES;
+    ctnode_count     = CT_OVERFLOW + 1;
+
+    ctnode_hash   = calloc(ctnode_hash_size, sizeof(unsigned int));
+    timeR_ctnodes = calloc(ctnode_max, sizeof(tr_ctnode_t));
+    if (ctnode_hash == NULL || timeR_ctnodes == NULL) {
+	fprintf(stderr, "ERROR: Failed to allocate the call tree!\n");
+	exit(2);
+    }
+
+    timeR_ctnodes[CT_OVERFLOW].parent = CT_ROOT;
+    timeR_current_ctnode = CT_ROOT;
+}
+
+void timeR_calltree_enter(tr_timer_t *m, unsigned int bin_id) {
+    unsigned int node = lookupadd_ctnode(timeR_current_ctnode, bin_id);
+
+    m->parent_node       = timeR_current_ctnode;
+    timeR_current_ctnode = node;
+    timeR_ctnodes[node].starts++;
+}
+
+static void reset_calltree(void) {
+    if (timeR_ctnodes == NULL)
+	return;
+
+    for (unsigned int i = 0; i < ctnode_count; i++) {
+	timeR_ctnodes[i].sum_self  = 0;
+	timeR_ctnodes[i].sum_total = 0;
+	timeR_ctnodes[i].starts    = 0;
+    }
+    ctnode_dropped = 0;
+}
+
+/* write the call tree in the "folded stacks" format used by flame  */
+/* graph tools: one line per context, "outer;...;inner self_time"   */
+static void timeR_dump_calltree(FILE *fd) {
+    unsigned int *path = malloc(sizeof(unsigned int) * ctnode_count);
+    if (path == NULL)
+	abort();
+
+    if (ctnode_dropped > 0)
+	fprintf(stderr, "WARNING: timeR call tree was limited to %u nodes, "
+		"%u contexts were merged into <calltree overflow>\n",
+		ctnode_count, ctnode_dropped);
+
+    for (unsigned int i = CT_OVERFLOW; i < ctnode_count; i++) {
+	tr_ctnode_t *node = &timeR_ctnodes[i];
+
+	if (node->sum_self / timeR_scale == 0)
+	    continue;
+
+	/* collect the context from the inside out */
+	unsigned int depth = 0;
+	bool internal = false;
+	for (unsigned int n = i; n != CT_ROOT; n = timeR_ctnodes[n].parent) {
+	    if (n != CT_OVERFLOW && timeR_ctnodes[n].bin_id <= TR_OverheadTest3)
+		internal = true;
+	    path[depth++] = n;
+	}
+
+	if (internal)
+	    continue;
 
-        fprintf(fd, "#!CHILD\t%d\n", i+1);
+	while (depth-- > 0) {
+	    unsigned int n = path[depth];
 
-        while (fgets(str, sizeof(str), childfd)) {
-          fprintf(fd, "%s", str);
-        }
+	    if (n == CT_OVERFLOW) {
+		fprintf(fd, "<calltree overflow>");
+	    } else {
+		tr_bin_t *bin = &timeR_bins[timeR_ctnodes[n].bin_id];
 
-        fclose(childfd);
-      }
+		if (bin->prefix != NULL)
+		    fprintf(fd, "%s:", bin->prefix);
+		fprintf(fd, "%s", bin->name);
+	    }
+
+	    fputc(depth > 0 ? ';' : ' ', fd);
+	}
+
+	fprintf(fd, "%lld\n", node->sum_self / timeR_scale);
     }
 
-    // FIXME: Check for errors
-    fclose(fd);
+    free(path);
 }
 
-void timeR_measureblock_full(void) {
-    /* current block is now full, switch to the next one */
-    timeR_current_mblockidx++;
 
-    /* check for overflow */
-    if (timeR_current_mblockidx == TIME_R_MAX_MBLOCKS) {
-        /* abort here - timeR_measureblocks can't be realloced because all
-           existing tr_measureptr_t reference into it */
-        fprintf(stderr, "ERROR: Too many timers allocated!\n"
-                "increase TIME_R_MAX_MBLOCKS and recompile\n");
-        abort();
-    }
+/*** binary trace ***/
 
-    /* allocate a new block if neccessary */
-    if (timeR_measureblocks[timeR_current_mblockidx] == NULL) {
-        timeR_measureblocks[timeR_current_mblockidx] = malloc(sizeof(tr_timer_t) * TIME_R_MBLOCK_SIZE);
-        if (timeR_measureblocks[timeR_current_mblockidx] == NULL) {
-            fprintf(stderr, "ERROR: Timer block allocation failed!\n");
-            abort();
-        }
-        max_mbindex = timeR_current_mblockidx;
-    }
+/* append events to the trace file through a temporary mapping */
+static void trace_write_events(const tr_event_t *events, unsigned int count) {
+    size_t len      = count * sizeof(tr_event_t);
+    off_t  off      = TRACE_DATA_OFFSET + trace_events_written * sizeof(tr_event_t);
+    off_t  pagemask = sysconf(_SC_PAGESIZE) - 1;
+    off_t  mapoff   = off & ~pagemask;
 
-    timeR_current_mblock = timeR_measureblocks[timeR_current_mblockidx];
-    timeR_next_mindex    = 0;
-}
+    if (ftruncate(trace_fd, off + len) != 0) {
+	perror("timeR: extend trace file");
+	return;
+    }
 
-void timeR_end_timers_slowpath(const tr_measureptr_t *mptr, timeR_t when) {
-    /* loop until the passed timer has been processed */
-    do {
-	timeR_end_latest_timer(when);
+    char *map = mmap(NULL, len + (off - mapoff), PROT_READ | PROT_WRITE,
+		     MAP_SHARED, trace_fd, mapoff);
+    if (map == MAP_FAILED) {
+	perror("timeR: map trace file");
+	return;
+    }
 
-	/* update abort counter if this isn't the top timer */
-	if (timeR_current_mblock != mptr->curblock ||
-	    timeR_next_mindex    != mptr->index)
-            timeR_bins[timeR_current_mblock[timeR_next_mindex].bin_id].aborts++;
+    memcpy(map + (off - mapoff), events, len);
+    munmap(map, len + (off - mapoff));
 
-    } while (timeR_current_mblock != mptr->curblock ||
-             timeR_next_mindex    != mptr->index);
+    trace_events_written += count;
 }
 
-unsigned int timeR_add_userfn_bin(void) {
-    /* check if there are bins available */
-    if (next_bin >= bin_count) {
-        // FIXME: consider switching to (limited?) exponential resizes
-	tr_bin_t *newbins =
-	    realloc(timeR_bins, (bin_count + TIME_R_REALLOC_BINS) *
-	                  sizeof(tr_bin_t));
+static void *trace_writer(void *unused) {
+    pthread_mutex_lock(&trace_mutex);
 
-	if (newbins == NULL)
-	    /* realloc failed, return the fallback */
-	    return TR_UserFuncFallback;
+    for (;;) {
+	while (trace_chunk_len[trace_cons_idx] == 0 && !trace_stop)
+	    pthread_cond_wait(&trace_cond, &trace_mutex);
 
-	/* clear the new entries */
-	memset(newbins + bin_count, 0, sizeof(tr_bin_t) * TIME_R_REALLOC_BINS);
+	/* stop only after all full chunks were written */
+	unsigned int count = trace_chunk_len[trace_cons_idx];
+	if (count == 0)
+	    break;
 
-	/* update bookkeeping */
-	timeR_bins = newbins;
-	bin_count += TIME_R_REALLOC_BINS;
+	pthread_mutex_unlock(&trace_mutex);
+	trace_write_events(trace_chunks[trace_cons_idx], count);
+	pthread_mutex_lock(&trace_mutex);
+
+	trace_chunk_len[trace_cons_idx] = 0;
+	trace_cons_idx = (trace_cons_idx + 1) % TIME_R_TRACE_CHUNKS;
+	pthread_cond_broadcast(&trace_cond);
     }
 
-    return next_bin++;
+    pthread_mutex_unlock(&trace_mutex);
+    return NULL;
 }
 
-void timeR_name_bin(unsigned int bin_id, const char *name) {
-    /* create permanent copy of name */
-    char *copy = strdup(name);
-    if (!copy)
-        copy = userfunc_unknown_str;
+/* hand the current chunk to the writer and continue with the next one */
+static void trace_switch_chunk(void) {
+    tr_event_t *chunk = trace_chunks[trace_prod_idx];
 
-    if (timeR_bins[bin_id].name != NULL)
-        free(timeR_bins[bin_id].name);
+    pthread_mutex_lock(&trace_mutex);
+    trace_chunk_len[trace_prod_idx] = timeR_trace_next - chunk;
+    trace_prod_idx = (trace_prod_idx + 1) % TIME_R_TRACE_CHUNKS;
+    pthread_cond_broadcast(&trace_cond);
 
-    timeR_bins[bin_id].name = copy;
+    if (trace_chunk_len[trace_prod_idx] != 0) {
+	/* the writer fell behind, wait for it */
+	trace_stalls++;
+	while (trace_chunk_len[trace_prod_idx] != 0)
+	    pthread_cond_wait(&trace_cond, &trace_mutex);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+
+    timeR_trace_next  = trace_chunks[trace_prod_idx];
+    timeR_trace_limit = timeR_trace_next + TIME_R_TRACE_CHUNK_EVENTS;
 }
 
-/* set a bin name for an anonymous function */
-void timeR_name_bin_anonfunc(unsigned int bin_id, const char *filename,
-                             unsigned int line, unsigned int pos) {
-  char nametmp[1024];
+static void trace_put(uint32_t word, uint32_t delta) {
+    if (timeR_trace_next >= timeR_trace_limit)
+	trace_switch_chunk();
 
-  nametmp[sizeof(nametmp) - 1] = 0;
-  snprintf(nametmp, sizeof(nametmp), "%s:<anon function defined in line %d column %d>",
-           filename, line, pos);
-  timeR_name_bin(bin_id, nametmp);
+    timeR_trace_next->word  = word;
+    timeR_trace_next->delta = delta;
+    timeR_trace_next++;
 }
 
-/* explicitly stop timers if a SETJMP returns */
-/* This function is not inlined because it is assumed that */
-/* it will only rarely be called.                          */
-void timeR_release(tr_measureptr_t *marker) {
-    /* check if anything needs to be done at all */
-    if (marker->curblock == timeR_current_mblock &&
-        marker->index    == timeR_next_mindex)
-        return;
+void timeR_trace_slowpath(unsigned int type, unsigned int bin_id, timeR_t delta) {
+    /* the clock went backwards, e.g. rdtsc after a move to another socket */
+    if (delta < 0)
+	delta = 0;
 
-    /* marker points to an allocated measurement, end it */
-    timeR_end_timer(marker);
+    if (delta > UINT32_MAX) {
+	trace_put(TR_TRACE_DELTAHI << 30, (uint32_t)(delta >> 32));
+	delta &= UINT32_MAX;
+    }
+
+    trace_put((type << 30) | bin_id, (uint32_t)delta);
 }
 
-/* debug aid: dump the current timer stack to stderr */
-void timeR_dump_timer_stack(void) {
-    tr_timer_t  *cur_mblock = timeR_measureblocks[0];
-    unsigned int mbidx      = 0;
-    unsigned int idx        = 1;
-    unsigned int i          = 0;
+static void trace_start(const char *filename) {
+    tr_trace_header_t header;
 
-    fprintf(stderr,"--- current timer stack:\n");
+    trace_fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (trace_fd < 0) {
+	fprintf(stderr, "WARNING: Unable to open %s: %s\n", filename, strerror(errno));
+	return;
+    }
 
-    while (mbidx != timeR_current_mblockidx ||
-	   idx   != timeR_next_mindex) {
-	fprintf(stderr, "%3d: %3d (%s)\n", i,
-		cur_mblock[idx].bin_id,
-		timeR_bins[cur_mblock[idx].bin_id].name);
-	i++;
-	idx++;
-	if (idx >= TIME_R_MBLOCK_SIZE) {
-	    idx = 0;
-	    mbidx++;
-	    cur_mblock = timeR_measureblocks[mbidx];
+    for (unsigned int i = 0; i < TIME_R_TRACE_CHUNKS; i++) {
+	if (trace_chunks[i] == NULL) {
+	    trace_chunks[i] = malloc(TIME_R_TRACE_CHUNK_EVENTS * sizeof(tr_event_t));
+	    if (trace_chunks[i] == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate the trace buffer!\n");
+		exit(2);
+	    }
 	}
+	trace_chunk_len[i] = 0;
+    }
+
+    trace_prod_idx       = 0;
+    trace_cons_idx       = 0;
+    trace_stop           = false;
+    trace_events_written = 0;
+    trace_stalls         = 0;
+    timeR_trace_next     = trace_chunks[0];
+    timeR_trace_limit    = timeR_trace_next + TIME_R_TRACE_CHUNK_EVENTS;
+    timeR_trace_last     = tr_now();
+
+    /* the header is completed when the trace is finished */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "timeRtrc", 8);
+    header.version    = 1;
+    header.event_size = sizeof(tr_event_t);
+    header.start      = timeR_trace_last;
+    strncpy(header.unit, TIME_R_UNIT, sizeof(header.unit) - 1);
+
+    if (pwrite(trace_fd, &header, sizeof(header), 0) != sizeof(header) ||
+	pthread_create(&trace_thread, NULL, trace_writer, NULL) != 0) {
+	fprintf(stderr, "WARNING: Unable to start the timeR trace in %s\n", filename);
+	close(trace_fd);
+	trace_fd = -1;
+	return;
     }
+
+    timeR_trace_enabled = 1;
 }
 
+/* enable the binary trace, called after --timeR-trace is parsed */
+void timeR_trace_setup(void) {
+    if (!timeR_trace_enabled)
+	trace_start(timeR_trace_file);
+}
 
-/*** external function timing ***/
+/* flush all events and append the table of bin names */
+static void trace_finish(void) {
+    if (!timeR_trace_enabled)
+	return;
 
-/* adapted version of djbhash */
-static unsigned int hash_address(const void *addr) {
-    unsigned int hash = 5381;
-    unsigned int i    = 0;
-    char data[sizeof(addr)];
+    timeR_trace_enabled = 0;
+    if (timeR_trace_next != trace_chunks[trace_prod_idx])
+	trace_switch_chunk();
+
+    pthread_mutex_lock(&trace_mutex);
+    trace_stop = true;
+    pthread_cond_broadcast(&trace_cond);
+    pthread_mutex_unlock(&trace_mutex);
+    pthread_join(trace_thread, NULL);
 
-    memcpy(data, &addr, sizeof(addr));
-    for (i = 0; i < sizeof(addr); i++) {
-	hash = ((hash << 5) + hash) + data[i];
+    tr_trace_header_t header;
+    if (pread(trace_fd, &header, sizeof(header), 0) != sizeof(header)) {
+	close(trace_fd);
+	return;
     }
 
-    return hash;
-}
+    header.events       = trace_events_written;
+    header.names_offset = TRACE_DATA_OFFSET + trace_events_written * sizeof(tr_event_t);
+    header.stalls       = trace_stalls;
 
-/* look up bin id for external function in our map, return 0 if not found */
-static unsigned int lookup_extfunc(void *addr) {
-    unsigned int hash = hash_address(addr);
-    unsigned int modhash = hash % extfunc_map_length;
+    FILE *fd = fdopen(trace_fd, "w");
+    if (fd == NULL) {
+	close(trace_fd);
+	return;
+    }
+
+    /* name table: count, then length and "prefix:name" for each bin */
+    uint32_t count = next_bin;
+    fseek(fd, header.names_offset, SEEK_SET);
+    fwrite(&count, sizeof(count), 1, fd);
+
+    for (unsigned int i = 0; i < next_bin; i++) {
+	char     name[1024];
+	tr_bin_t *bin = &timeR_bins[i];
 
-    if (extfunc_map[modhash].addr == addr) {
-	/* found entry in map */
-	return extfunc_map[modhash].bin_id;
+	snprintf(name, sizeof(name), "%s%s%s",
+		 bin->prefix != NULL ? bin->prefix : "",
+		 bin->prefix != NULL ? ":" : "", bin->name);
+
+	uint32_t len = strlen(name);
+	fwrite(&len, sizeof(len), 1, fd);
+	fwrite(name, 1, len, fd);
     }
 
-    return 0;
+    fseek(fd, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, fd);
+
+    // FIXME: Check for errors
+    fclose(fd);
+    trace_fd = -1;
 }
 
-static unsigned int lookupadd_extfunc(char *name, void *addr);
 
-/* add bin for external function to our map */
-static unsigned int add_extfunc(char *name, void *addr) {
-    unsigned int hash = hash_address(addr);
-    unsigned int modhash = hash % extfunc_map_length;
+/*** external function timing ***/
 
-    if (extfunc_map[modhash].addr == NULL) {
-	/* did not find an entry, but an empty slot */
-	unsigned int bin_id = timeR_add_userfn_bin();
-	timeR_name_bin(bin_id, name);
-	timeR_bins[bin_id].prefix = "<ExternalCode>";
+/* Fibonacci hashing, the top bits of the product are well mixed even */
+/* though function addresses share their low (alignment) bits        */
+static unsigned int hash_address(const void *addr) {
+    uint64_t a = (uintptr_t)addr;
 
-	extfunc_map[modhash].addr   = addr;
-	extfunc_map[modhash].bin_id = bin_id;
-	extfunc_map_entries++;
+    return (unsigned int)((a * 11400714819323198485ull) >> 32);
+}
 
-	return bin_id;
-    }
+/* insert a new entry, the map must have a free slot */
+static void insert_extfunc(tr_extfunc_entry_t *map, unsigned int length,
+			   void *addr, unsigned int bin_id) {
+    unsigned int i = hash_address(addr) & (length - 1);
 
-    /* found a collision */
-    // Rebuild hash table with larger size and retry
-    // FIXME: There are better algorithms for this
-    tr_extfunc_entry_t *newmap;
-    unsigned int newlength = extfunc_map_length + TIME_R_EXTFUNC_MAP_STEP;
+    /* linear probing */
+    while (map[i].addr != NULL)
+	i = (i + 1) & (length - 1);
 
- retry:
-    newmap = calloc(newlength, sizeof(tr_extfunc_entry_t));
-    if (newmap == NULL) {
-	abort();
-    }
+    map[i].addr   = addr;
+    map[i].bin_id = bin_id;
+}
 
-    for (unsigned int i = 0; i < extfunc_map_length; i++) {
-	if (extfunc_map[i].addr != NULL) {
-	    unsigned int newhash = hash_address(extfunc_map[i].addr) % newlength;
+/* double the size of the map */
+static void grow_extfunc_map(void) {
+    unsigned int        newlength = 2 * extfunc_map_length;
+    tr_extfunc_entry_t *newmap    = calloc(newlength, sizeof(tr_extfunc_entry_t));
 
-	    if (newmap[newhash].addr != NULL) {
-		/* collision on rehashing */
-		free(newmap);
-		newlength += TIME_R_EXTFUNC_MAP_STEP;
-		goto retry;
-	    }
+    if (newmap == NULL)
+	abort();
 
-	    newmap[newhash].addr   = extfunc_map[i].addr;
-	    newmap[newhash].bin_id = extfunc_map[i].bin_id;
-	}
-    }
+    for (unsigned int i = 0; i < extfunc_map_length; i++)
+	if (extfunc_map[i].addr != NULL)
+	    insert_extfunc(newmap, newlength,
+			   extfunc_map[i].addr, extfunc_map[i].bin_id);
 
-    /* switch to new map */
     free(extfunc_map);
     extfunc_map        = newmap;
     extfunc_map_length = newlength;
-
-    /* use a recursive call for the actual insertion */
-    return lookupadd_extfunc(name, addr);
 }
 
 /* look up bin id for external function in our map, add if not found */
-static unsigned int lookupadd_extfunc(char *name, void *addr) {
-    unsigned int bin_id = lookup_extfunc(addr);
+static unsigned int lookupadd_extfunc(const char *name, void *addr) {
+    unsigned int i = hash_address(addr) & (extfunc_map_length - 1);
 
-    if (bin_id != 0)
-	return bin_id;
-    else
-	return add_extfunc(name, addr);
+    while (extfunc_map[i].addr != NULL) {
+	if (extfunc_map[i].addr == addr)
+	    return extfunc_map[i].bin_id;
+
+	i = (i + 1) & (extfunc_map_length - 1);
+    }
+
+#ifdef HAVE_DLADDR
+    /* callers without a symbol name, e.g. .Call from byte code */
+    Dl_info info;
+    if (name == NULL && dladdr(addr, &info) && info.dli_sname != NULL)
+	name = info.dli_sname;
+#endif
+
+    /* not found, addresses of the same symbol in reloaded libraries */
+    /* share a bin                                                  */
+    unsigned int bin_id = intern_bin("<ExternalCode>", NULL, 0, 0,
+				     name != NULL ? name : "<unknown>");
+
+    /* keep the load factor below 1/2 */
+    if (2 * (extfunc_map_entries + 1) > extfunc_map_length)
+	grow_extfunc_map();
+
+    insert_extfunc(extfunc_map, extfunc_map_length, addr, bin_id);
+    extfunc_map_entries++;
+
+    return bin_id;
 }
 
-tr_measureptr_t timeR_begin_external(char *name, void *addr) { // FIXME: should use DL_FUNC
+tr_measureptr_t timeR_begin_external(const char *name, void *addr,
+				     unsigned int *cache) { // FIXME: should use DL_FUNC
     /* look up address in the map */
     BEGIN_TIMER(TR_HashOverhead);
     // TODO: Seperate overhead measurement, subtracted from total of other timers?
     unsigned int bin_id = lookupadd_extfunc(name, addr);
     END_TIMER(TR_HashOverhead);
 
+    if (cache != NULL)
+	*cache = bin_id;
+
     return timeR_begin_timer(bin_id);
 }
 
-static void timeR_reset_all(void) {
+/* clear all measurements, active timers continue from the current time */
+void timeR_reset_all(void) {
   /* reset all bins */
   for (unsigned int i = TR_HashOverhead; i < next_bin; i++) {
     tr_bin_t *bin = timeR_bins + i;
 
-    if (bin->name[0] != 0) {
-      bin->sum_self  = 0;
-      bin->sum_total = 0;
-      bin->starts    = 0;
-      bin->aborts    = 0;
-      bin->bcode     = 0;
-    }
+    bin->sum_self  = 0;
+    bin->sum_total = 0;
+    bin->starts    = 0;
+    bin->aborts    = 0;
+    bin->skipped   = 0;
+    bin->sample_countdown = 0;
+    bin->bcode     = 0;
+    bin->max       = 0;
+    bin->nodes_self  = 0;
+    bin->nodes_total = 0;
+    bin->bytes_self  = 0;
+    bin->bytes_total = 0;
+    bin->nested_self  = 0;
+    bin->nested_total = 0;
+    bin->wall_ns      = 0;
+    bin->cpu_ns       = 0;
+    if (bin->hist != NULL)
+      memset(bin->hist, 0, TR_HIST_BUCKETS * sizeof(unsigned int));
+    if (bin->counters != NULL)
+      memset(bin->counters, 0, 2 * TIME_R_MAX_COUNTERS * sizeof(uint64_t));
   }
 
-  assert(timeR_current_mblock == timeR_measureblocks[0]); // we shouldn't have many active timers here
+  reset_calltree();
+  memset(gc_levels, 0, sizeof(gc_levels));
 
   /* reset all stack entries */
   start_time = tr_now();
 
-  for (unsigned int i = 1; i < timeR_next_mindex; i++) {
-    timeR_current_mblock[i].start     = start_time;
-    timeR_current_mblock[i].lower_sum = 0;
+  for (tr_timer_t *m = timeR_stack + 1; m < timeR_stack_top; m++) {
+    m->start     = start_time;
+    m->lower_sum = 0;
+
+    if (timeR_alloc_stack != NULL) {
+      tr_alloc_t *a = &timeR_alloc_stack[m - timeR_stack];
+
+      a->nodes_start = timeR_alloc_nodes;
+      a->bytes_start = timeR_alloc_bytes;
+      a->nodes_lower = 0;
+      a->bytes_lower = 0;
+    }
+
+    if (timeR_nested_stack != NULL) {
+      tr_nested_t *n = &timeR_nested_stack[m - timeR_stack];
+
+      n->starts_start = timeR_nested_starts - 1;
+      n->starts_lower = 0;
+    }
   }
+  timeR_current_lower_sum = 0;
+  timeR_alloc_lower_nodes = 0;
+  timeR_alloc_lower_bytes = 0;
+  timeR_nested_lower = 0;
+  reset_counters();
+
+  memset(timeR_bcop_self,  0, sizeof(timeR_bcop_self));
+  memset(timeR_bcop_count, 0, sizeof(timeR_bcop_count));
+  timeR_bcop_start = start_time;
 
   free(idletimes);
   idletimes = NULL;
@@ -973,13 +2852,32 @@ static void timeR_reset_all(void) {
 
 void timeR_forked(long childpid) {
   if (childpid == 0) {
-    /* in child */
-    if (R_isForkedChild) {
-      fprintf(stderr, "*** ERROR: Forking from child processes is currently not supported!\n");
-      abort();
-    }
+    /* in child, possibly of another child */
+    fork_depth++;
 
+    /* the counters still measure the parent, open new ones */
+    reopen_counters();
     timeR_reset_all();
+
+    if (timeR_trace_enabled) {
+      /* the writer thread did not survive the fork, start a new trace */
+      char tracefn[1024];
+
+      timeR_trace_enabled = 0;
+      close(trace_fd);
+      trace_fd = -1;
+      pthread_mutex_init(&trace_mutex, NULL);
+      pthread_cond_init(&trace_cond, NULL);
+
+      snprintf(tracefn, sizeof(tracefn), "%s_%d", timeR_trace_file, getpid());
+      trace_start(tracefn);
+    }
+    /* helper threads do not exist in the child */
+    threads          = NULL;
+    thread_bin_count = 0;
+    threads_measured = 0;
+    pthread_mutex_init(&thread_mutex, NULL);
+
     for (unsigned int i = 0; i < childfiles_count; i++)
       free(childfiles[i]);
     free(childfiles);
@@ -989,13 +2887,51 @@ void timeR_forked(long childpid) {
     return;
   }
 
-  /* in parent, add child to list of known PIDs */
+  /* in parent, children publish their results in the shared segment; */
+  /* those that do not fit list their PID in it for the main process  */
+  if (child_shm != NULL)
+    return;
+
+  /* otherwise they write a file named after their PID */
   char childfn[1024];
   childfn[sizeof(childfn)-1] = 0;
   snprintf(childfn, sizeof(childfn)-1, "%s_%ld", timeR_output_file, childpid);
   add_childfile(childfn);
 }
 
+static inline uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void timeR_cpu_begin(tr_cputime_t *start) {
+    start->wall_ns = clock_ns(CLOCK_MONOTONIC);
+    start->cpu_ns  = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void timeR_cpu_end(unsigned int bin_id, const tr_cputime_t *start) {
+    if (timeR_bins == NULL)
+	return;
+
+    uint64_t  cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    tr_bin_t *bin = &timeR_bins[bin_id];
+
+    bin->wall_ns += clock_ns(CLOCK_MONOTONIC) - start->wall_ns;
+    bin->cpu_ns  += cpu - start->cpu_ns;
+}
+
+void timeR_gc_collected(unsigned int level, uint64_t nodes_marked,
+			uint64_t nodes_freed, uint64_t bytes_freed) {
+    tr_gc_level_t *l = &gc_levels[level < TIME_R_MAX_GC_LEVELS ? level : TIME_R_MAX_GC_LEVELS - 1];
+
+    l->collections++;
+    l->nodes_marked += nodes_marked;
+    l->nodes_freed  += nodes_freed;
+    l->bytes_freed  += bytes_freed;
+}
+
 void timeR_idlemark(int state) {
   if ((state && in_idle) || (!state && !in_idle)) {
     fprintf(stderr, "=== Warning: idlemark received %d while already in that state\n", state);
@@ -1057,3 +2993,377 @@ void timeR_getchildfile(char *buffer) {
 
   add_childfile(buffer);
 }
+
+
+/*** helper threads ***/
+
+/* set up timers for the calling thread, returns 0 on success; the */
+/* main thread is always set up                                    */
+int timeR_thread_begin(void) {
+    if (timeR_stack != NULL)
+	return 0;
+
+    tr_thread_t *t     = calloc(1, sizeof(tr_thread_t));
+    tr_timer_t  *stack = mmap(NULL, TIME_R_THREAD_STACK_ENTRIES * sizeof(tr_timer_t),
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (t != NULL && stack != MAP_FAILED) {
+	t->bin_count = TR_StaticBinCount + TIME_R_REALLOC_BINS;
+	t->next_bin  = TR_StaticBinCount;
+	t->bins      = calloc(t->bin_count, sizeof(tr_bin_t));
+    }
+
+    if (t == NULL || stack == MAP_FAILED || t->bins == NULL) {
+	fprintf(stderr, "WARNING: Failed to set up timeR for a thread!\n");
+	if (stack != MAP_FAILED)
+	    munmap(stack, TIME_R_THREAD_STACK_ENTRIES * sizeof(tr_timer_t));
+	free(t);
+	return -1;
+    }
+
+    for (unsigned int i = 0; i < TR_StaticBinCount; i++)
+	t->bins[i].name = (char *)bin_names[i];
+
+    timeR_stack       = stack;
+    timeR_stack_top   = stack + 1;
+    timeR_stack_limit = stack + TIME_R_THREAD_STACK_ENTRIES;
+    timeR_bins        = t->bins;
+    thread_state      = t;
+
+    pthread_mutex_lock(&thread_mutex);
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock(&thread_mutex);
+
+    return 0;
+}
+
+/* add the used bins of a thread to thread_bins by name, called with */
+/* thread_mutex held                                                 */
+static void merge_thread_bins(const tr_thread_t *t) {
+    for (unsigned int i = 0; i < t->next_bin; i++) {
+	const tr_bin_t *src = &t->bins[i];
+	tr_bin_t       *dest = NULL;
+
+	if (src->starts == 0)
+	    continue;
+
+	for (unsigned int j = 0; j < thread_bin_count; j++)
+	    if (!strcmp(thread_bins[j].name, src->name)) {
+		dest = &thread_bins[j];
+		break;
+	    }
+
+	if (dest == NULL) {
+	    if (thread_bin_count >= thread_bin_max) {
+		unsigned int newmax  = thread_bin_max != 0 ? 2 * thread_bin_max : 64;
+		tr_bin_t    *newbins = realloc(thread_bins, newmax * sizeof(tr_bin_t));
+
+		if (newbins == NULL)
+		    abort();
+
+		thread_bins    = newbins;
+		thread_bin_max = newmax;
+	    }
+
+	    dest = &thread_bins[thread_bin_count++];
+	    memset(dest, 0, sizeof(tr_bin_t));
+	    dest->name = strdup(src->name);
+	    if (dest->name == NULL)
+		abort();
+	}
+
+	dest->sum_self  += src->sum_self;
+	dest->sum_total += src->sum_total;
+	dest->starts    += src->starts;
+	dest->aborts    += src->aborts;
+	dest->wall_ns   += src->wall_ns;
+	dest->cpu_ns    += src->cpu_ns;
+
+	if (src->hist != NULL) {
+	    if (dest->hist == NULL)
+		timeR_hist_alloc(dest);
+	    for (unsigned int j = 0; j < TR_HIST_BUCKETS; j++)
+		dest->hist[j] += src->hist[j];
+	    if (src->max > dest->max)
+		dest->max = src->max;
+	}
+    }
+}
+
+/* stop the running timers of the calling thread and hand its bins to */
+/* the main thread, which lists them after its own bins               */
+void timeR_thread_end(void) {
+    tr_thread_t *t = thread_state;
+
+    if (t == NULL)
+	return;
+
+    if (timeR_stack_top != timeR_stack + 1) {
+	tr_measureptr_t mptr = { timeR_stack + 1 };
+	timeR_end_timer(&mptr);
+    }
+
+    pthread_mutex_lock(&thread_mutex);
+    for (tr_thread_t **p = &threads; *p != NULL; p = &(*p)->next)
+	if (*p == t) {
+	    *p = t->next;
+	    break;
+	}
+    merge_thread_bins(t);
+    threads_measured++;
+    pthread_mutex_unlock(&thread_mutex);
+
+    for (unsigned int i = 0; i < t->next_bin; i++) {
+	free(t->bins[i].hist);
+	if (i >= TR_StaticBinCount)
+	    free(t->bins[i].name);
+    }
+    free(t->bins);
+    munmap(timeR_stack, TIME_R_THREAD_STACK_ENTRIES * sizeof(tr_timer_t));
+    free(t);
+
+    timeR_stack       = NULL;
+    timeR_stack_top   = NULL;
+    timeR_stack_limit = NULL;
+    timeR_bins        = NULL;
+    thread_state      = NULL;
+}
+
+/* ID of a named timer of the calling thread, 0 if the thread is not */
+/* set up; in the main thread these are external code bins           */
+unsigned int timeR_thread_timer(const char *name) {
+    tr_thread_t *t = thread_state;
+
+    if (timeR_stack == NULL)
+	return 0;
+
+    if (t == NULL)
+	return intern_bin("<ExternalCode>", NULL, 0, 0, name);
+
+    for (unsigned int i = TR_StaticBinCount; i < t->next_bin; i++)
+	if (!strcmp(t->bins[i].name, name))
+	    return i;
+
+    char *copy = strdup(name);
+    if (copy == NULL)
+	return 0;
+
+    if (t->next_bin >= t->bin_count) {
+	/* the main thread may read the bins while they are moved */
+	pthread_mutex_lock(&thread_mutex);
+	tr_bin_t *newbins = realloc(t->bins, (t->bin_count + TIME_R_REALLOC_BINS) *
+				    sizeof(tr_bin_t));
+	if (newbins != NULL) {
+	    memset(newbins + t->bin_count, 0, TIME_R_REALLOC_BINS * sizeof(tr_bin_t));
+	    t->bins       = newbins;
+	    t->bin_count += TIME_R_REALLOC_BINS;
+	    timeR_bins    = newbins;
+	}
+	pthread_mutex_unlock(&thread_mutex);
+
+	if (newbins == NULL) {
+	    free(copy);
+	    return 0;
+	}
+    }
+
+    t->bins[t->next_bin].name = copy;
+    return t->next_bin++;
+}
+
+void timeR_thread_start(unsigned int timer) {
+    if (timer != 0 && timeR_stack != NULL)
+	timeR_begin_timer(timer);
+}
+
+/* stop the newest running timer with this ID and the timers that */
+/* were started after it, which count as aborted                   */
+void timeR_thread_stop(unsigned int timer) {
+    if (timer == 0 || timeR_stack == NULL)
+	return;
+
+    for (tr_timer_t *m = timeR_stack_top - 1; m > timeR_stack; m--)
+	if (m->bin_id == timer) {
+	    tr_measureptr_t mptr = { m };
+	    timeR_end_timer(&mptr);
+	    return;
+	}
+}
+
+/* the bins of all helper threads, threads that are still running */
+/* are included with the timers they finished                      */
+static void dump_threads(FILE *fd) {
+    pthread_mutex_lock(&thread_mutex);
+
+    unsigned int running = 0;
+    for (tr_thread_t *t = threads; t != NULL; t = t->next) {
+	merge_thread_bins(t);
+	running++;
+    }
+
+    if (thread_bin_count == 0) {
+	pthread_mutex_unlock(&thread_mutex);
+	return;
+    }
+
+    tr_bin_t **binpointers = malloc(sizeof(tr_bin_t *) * thread_bin_count);
+    if (binpointers == NULL)
+	abort();
+
+    for (unsigned int i = 0; i < thread_bin_count; i++)
+	binpointers[i] = &thread_bins[i];
+
+    if (!timeR_output_raw)
+	qsort(binpointers, thread_bin_count, sizeof(tr_bin_t *), compare_selftime_desc);
+
+    if (timeR_output_json) {
+	fprintf(fd, ",\n\"threads_measured\": %u", threads_measured + running);
+	json_print_bins(fd, "threads", binpointers, thread_bin_count, true);
+    } else {
+	fprintf(fd, "ThreadsMeasured\t%u\n", threads_measured + running);
+	fprintf(fd, "#!CHILD\tthreads\n");
+	if (timeR_output_raw)
+	    fprintf(fd, "#!LABEL\tself\ttotal\tcalls\taborts\thas_bcode%s%s\n",
+		    timeR_alloc_stack != NULL ? ALLOC_LABELS : "", counter_labels);
+	else
+	    fprintf(fd, "# --- individual timers\tself_percentage\tself\ttotal\tcalls\taborts\thas_bcode%s%s%s\n",
+		    timeR_alloc_stack != NULL ? ALLOC_LABELS : "", counter_labels,
+		    timeR_histograms ? "\tp50\tp90\tp99\tmax" : "");
+
+	timeR_t all_self = end_time - start_time;
+	for (unsigned int i = 0; i < thread_bin_count; i++)
+	    timeR_print_bin(fd, binpointers[i], true,
+			    timeR_output_raw ? 0 : (all_self != 0 ? all_self : 1),
+			    !timeR_output_raw && timeR_histograms);
+    }
+
+    free(binpointers);
+    pthread_mutex_unlock(&thread_mutex);
+}
+
+
+/*** live queries from R ***/
+
+/* current values of all bins that were started, as a data frame */
+SEXP timeR_bins_dataframe(void) {
+    static const char *colnames[] = {
+	"id", "name", "self", "total", "calls", "aborts", "has_bcode"
+    };
+    unsigned int count = 0;
+
+    for (unsigned int i = TR_Startup; i < next_bin; i++)
+	if (timeR_bins[i].starts + timeR_bins[i].skipped != 0)
+	    count++;
+
+    SEXP ans = PROTECT(allocVector(VECSXP, 7));
+    SEXP id     = allocVector(INTSXP,  count); SET_VECTOR_ELT(ans, 0, id);
+    SEXP name   = allocVector(STRSXP,  count); SET_VECTOR_ELT(ans, 1, name);
+    SEXP self   = allocVector(REALSXP, count); SET_VECTOR_ELT(ans, 2, self);
+    SEXP total  = allocVector(REALSXP, count); SET_VECTOR_ELT(ans, 3, total);
+    SEXP calls  = allocVector(REALSXP, count); SET_VECTOR_ELT(ans, 4, calls);
+    SEXP aborts = allocVector(REALSXP, count); SET_VECTOR_ELT(ans, 5, aborts);
+    SEXP bcode  = allocVector(LGLSXP,  count); SET_VECTOR_ELT(ans, 6, bcode);
+
+    /* the allocations below may start bins that were not counted yet */
+    unsigned int row = 0;
+    for (unsigned int i = TR_Startup; i < next_bin && row < count; i++) {
+	tr_bin_t *bin = &timeR_bins[i];
+	char      buf[1024];
+
+	if (bin->starts + bin->skipped == 0)
+	    continue;
+
+	/* extrapolate sampled bins like scale_sampled_bins */
+	double factor = bin->starts != 0 ?
+	    (double)(bin->starts + bin->skipped) / bin->starts : 0;
+
+	snprintf(buf, sizeof(buf), "%s%s%s",
+		 bin->prefix != NULL ? bin->prefix : "",
+		 bin->prefix != NULL ? ":" : "", bin->name);
+
+	INTEGER(id)[row]     = i;
+	SET_STRING_ELT(name, row, mkChar(buf));
+	REAL(self)[row]      = (double)bin->sum_self  * factor / timeR_scale;
+	REAL(total)[row]     = (double)bin->sum_total * factor / timeR_scale;
+	REAL(calls)[row]     = (double)(bin->starts + bin->skipped);
+	REAL(aborts)[row]    = (double)bin->aborts * factor;
+	LOGICAL(bcode)[row]  = bin->bcode;
+	row++;
+    }
+
+    SEXP names = PROTECT(allocVector(STRSXP, 7));
+    for (int i = 0; i < 7; i++)
+	SET_STRING_ELT(names, i, mkChar(colnames[i]));
+    setAttrib(ans, R_NamesSymbol, names);
+
+    SEXP rownames = PROTECT(allocVector(INTSXP, 2));
+    INTEGER(rownames)[0] = NA_INTEGER;
+    INTEGER(rownames)[1] = -(int)count;
+    setAttrib(ans, R_RowNamesSymbol, rownames);
+
+    setAttrib(ans, R_ClassSymbol, mkString("data.frame"));
+
+    UNPROTECT(3);
+    return ans;
+}
+
+
+/*** bin names from R bindings ***/
+
+/* name the bin of a closure after the variable it is bound to: in a  */
+/* namespace "pkg::name" if the variable is exported, else             */
+/* "pkg:::name"; elsewhere only anonymous functions are renamed, to    */
+/* "file:name" like the parser does for "name <- function"             */
+void timeR_name_closure(SEXP sym, SEXP fun, SEXP env) {
+    static SEXP nsinfo_symbol, exports_symbol;
+    SEXP srcref = getAttrib(fun, R_SrcrefSymbol);
+
+    if (!isSymbol(sym) || TYPEOF(srcref) != INTSXP || LENGTH(srcref) <= 8)
+	return;
+
+    unsigned int bin_id = INTEGER(srcref)[8];
+    if (bin_id < first_userfn_idx || bin_id >= next_bin)
+	return;
+
+    /* another copy of the function may have been renamed already */
+    bin_id = current_bin(bin_id);
+    INTEGER(srcref)[8] = bin_id;
+
+    char nametmp[1024];
+    SEXP spec = R_NamespaceEnvSpec(env);
+
+    nametmp[sizeof(nametmp) - 1] = 0;
+
+    if (isString(spec) && LENGTH(spec) > 0) {
+	/* base has no export list, everything in it is visible */
+	bool exported = true;
+
+	if (env != R_BaseNamespace) {
+	    if (nsinfo_symbol == NULL) {
+		nsinfo_symbol  = install(".__NAMESPACE__.");
+		exports_symbol = install("exports");
+	    }
+
+	    SEXP info    = findVarInFrame3(env, nsinfo_symbol, TRUE);
+	    SEXP exports = TYPEOF(info) == ENVSXP ?
+		findVarInFrame3(info, exports_symbol, TRUE) : R_UnboundValue;
+
+	    exported = TYPEOF(exports) == ENVSXP &&
+		findVarInFrame3(exports, sym, FALSE) != R_UnboundValue;
+	}
+
+	snprintf(nametmp, sizeof(nametmp), "%s%s%s",
+		 CHAR(STRING_ELT(spec, 0)), exported ? "::" : ":::",
+		 CHAR(PRINTNAME(sym)));
+    } else if (timeR_bins[bin_id].anon && timeR_bins[bin_id].srcfile != NULL) {
+	snprintf(nametmp, sizeof(nametmp), "%s:%s",
+		 timeR_bins[bin_id].srcfile, CHAR(PRINTNAME(sym)));
+    } else {
+	return;
+    }
+
+    if (strcmp(timeR_bins[bin_id].name, nametmp))
+	INTEGER(srcref)[8] = timeR_rename_bin(bin_id, nametmp);
+}
@@ -47,6 +47,7 @@ extern void R_ProcessEvents(void);
 #include "sock.h"
 
 #include <R_ext/Print.h> // for REprintf
+#include <timeR.h>
 
 static int sock_inited = 0;
 
@@ -517,10 +518,15 @@ ssize_t R_SockRead(int sockp, void *buf, size_t len, int blocking, int timeout)
 {
     ssize_t res;
 
-    if(blocking && (res = R_SocketWait(sockp, 0, timeout)) != 0)
+    BEGIN_IO_TIMER(TR_sockRead);
+    if(blocking && (res = R_SocketWait(sockp, 0, timeout)) != 0) {
+	END_IO_TIMER(TR_sockRead);
         return res < 0 ? res : 0; /* socket error or timeout */
+    }
     res = recv(sockp, buf, len, 0);
-    return (res >= 0) ? res : -socket_errno();
+    if (res < 0) res = -socket_errno();
+    END_IO_TIMER(TR_sockRead);
+    return res;
 }
 
 int R_SockOpen(int port)
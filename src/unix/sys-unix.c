@@ -36,6 +36,7 @@
 #include <Fileio.h>
 #include <Rmath.h> /* for fround */
 #include "Runix.h"
+#include "timeR.h"
 
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
@@ -249,6 +250,7 @@ SEXP attribute_hidden do_system(SEXP call, SEXP op, SEXP args, SEXP rho)
     intern = asLogical(CADR(args));
     if (intern == NA_INTEGER)
 	error(_("'intern' must be logical and not NA"));
+    BEGIN_IO_TIMER(TR_System);
     if (intern) { /* intern = TRUE */
 	FILE *fp;
 	char *x = "r",
@@ -326,6 +328,7 @@ SEXP attribute_hidden do_system(SEXP call, SEXP op, SEXP args, SEXP rho)
 		setAttrib(rval, lsym, mkString(strerror(errno)));
 	    }
 	}
+	END_IO_TIMER(TR_System);
 	UNPROTECT(2);
 	return rval;
     }
@@ -339,6 +342,7 @@ SEXP attribute_hidden do_system(SEXP call, SEXP op, SEXP args, SEXP rho)
 #ifdef HAVE_AQUA
 	R_Busy(0);
 #endif
+	END_IO_TIMER(TR_System);
 	UNPROTECT(1);
 	R_Visible = 0;
 	return tlist;
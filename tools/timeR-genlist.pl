@@ -124,6 +124,8 @@ EOF
 # read timer list from timeR.c
 my @timers;
 my @timer_states;
+my @timer_groups;
+my $cur_group = "internal";
 
 while (<IN>) {
     last if /MARKER:END/;
@@ -133,6 +135,7 @@ while (<IN>) {
         # timer name
         say OUT "    TR_$1,";
         push @timers, $1;
+        push @timer_groups, $cur_group;
 
         if (/MARKER:ALWAYS/) {
             push @timer_states, "A";
@@ -142,6 +145,11 @@ while (<IN>) {
     } else {
         # other string
         say OUT $_;
+
+        # a single-word comment starts a new timer group, e.g. "// memory.c"
+        if (/^\s*\/\/\s*([\w-]+)(?:\.c)?\s*$/) {
+            $cur_group = $1;
+        }
     }
 }
 
@@ -206,6 +214,17 @@ for (my $i = 0; $i < scalar(@timers); $i++) {
 
 print OUT <<EOF;
 
+};
+
+/* array of timer group names for run-time selection */
+static const char *timer_groups[] = {
+EOF
+
+for (my $i = 0; $i < scalar(@timers); $i++) {
+    say OUT "    \"$timer_groups[$i]\",";
+}
+
+print OUT <<EOF;
 };
 #endif
 
@@ -0,0 +1,797 @@
+/*
+ *  timeR : Deterministic profiling for R
+ *  Copyright (C) 2013  TU Dortmund Informatik LS XII
+ *  Inspired by r-timed from the Reactor group at Purdue,
+ *    http://r.cs.purdue.edu/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ */
+
+/*
+ * Merges and compares timeR output files written with --timeR-json.
+ * This is a standalone program, compile it with
+ *
+ *     cc -O2 -o timeR-merge tools/timeR-merge.c
+ *
+ * timeR-merge [-o OUTPUT] FILE...
+ *
+ *     sums up the timers of all FILEs by their prefix and name and
+ *     writes the result in the same format, to stdout by default. The
+ *     output can be merged again.
+ *
+ * timeR-merge -d [-n COUNT] BASE NEW
+ *
+ *     lists the change of every timer between BASE and NEW, largest
+ *     change of the self time first. Merged files are divided by their
+ *     number of runs first.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*** minimal JSON reader ***/
+
+typedef enum { J_NULL, J_BOOL, J_NUM, J_STR, J_ARR, J_OBJ } jtype_t;
+
+typedef struct jnode {
+    jtype_t       type;
+    char         *key;        /* member name if part of an object */
+    char         *str;        /* string value */
+    double        num;        /* numeric value, also used for booleans */
+    int64_t       inum;       /* numeric value if is_int */
+    bool          is_int;
+    struct jnode *child;      /* first element of an array or object */
+    struct jnode *next;       /* next element of the parent */
+} jnode_t;
+
+/* nodes of one file, freed all at once */
+typedef struct jchunk {
+    struct jchunk *next;
+    unsigned int   used;
+    jnode_t        nodes[4096];
+} jchunk_t;
+
+typedef struct {
+    char       *pos;
+    const char *file;
+    jchunk_t   *chunks;
+} jparser_t;
+
+static void die(const char *fmt, const char *arg) {
+    fprintf(stderr, "ERROR: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+static jnode_t *jalloc(jparser_t *p, jtype_t type) {
+    if (p->chunks == NULL || p->chunks->used == 4096) {
+	jchunk_t *chunk = malloc(sizeof(jchunk_t));
+	if (chunk == NULL)
+	    die("out of memory reading %s", p->file);
+	chunk->next = p->chunks;
+	chunk->used = 0;
+	p->chunks   = chunk;
+    }
+
+    jnode_t *n = &p->chunks->nodes[p->chunks->used++];
+    memset(n, 0, sizeof(jnode_t));
+    n->type = type;
+    return n;
+}
+
+static void skip_space(jparser_t *p) {
+    while (*p->pos == ' ' || *p->pos == '\t' || *p->pos == '\n' || *p->pos == '\r')
+	p->pos++;
+}
+
+/* unescape a string in place, timeR only writes \" \\ and \u00XX */
+static char *parse_string(jparser_t *p) {
+    char *start = ++p->pos, *out = start;
+
+    while (*p->pos != '"') {
+	if (*p->pos == 0)
+	    die("unterminated string in %s", p->file);
+
+	if (*p->pos == '\\') {
+	    p->pos++;
+	    switch (*p->pos) {
+	    case 'n': *out++ = '\n'; break;
+	    case 't': *out++ = '\t'; break;
+	    case 'r': *out++ = '\r'; break;
+	    case 'b': *out++ = '\b'; break;
+	    case 'f': *out++ = '\f'; break;
+	    case 'u': {
+		char hex[5] = { 0 };
+		if (strlen(p->pos + 1) < 4)
+		    die("bad escape in %s", p->file);
+		memcpy(hex, p->pos + 1, 4);
+		*out++ = (char)strtol(hex, NULL, 16);
+		p->pos += 4;
+		break;
+	    }
+	    default:  *out++ = *p->pos; break;
+	    }
+	    p->pos++;
+	} else {
+	    *out++ = *p->pos++;
+	}
+    }
+
+    p->pos++;
+    *out = 0;
+    return start;
+}
+
+static jnode_t *parse_value(jparser_t *p) {
+    jnode_t *n, **tail;
+
+    skip_space(p);
+    switch (*p->pos) {
+    case '{':
+    case '[': {
+	bool  obj   = *p->pos == '{';
+	char  close = obj ? '}' : ']';
+
+	n    = jalloc(p, obj ? J_OBJ : J_ARR);
+	tail = &n->child;
+	p->pos++;
+	skip_space(p);
+	while (*p->pos != close) {
+	    char *key = NULL;
+
+	    if (obj) {
+		if (*p->pos != '"')
+		    die("expected a member name in %s", p->file);
+		key = parse_string(p);
+		skip_space(p);
+		if (*p->pos++ != ':')
+		    die("expected ':' in %s", p->file);
+	    }
+
+	    *tail = parse_value(p);
+	    (*tail)->key = key;
+	    tail = &(*tail)->next;
+
+	    skip_space(p);
+	    if (*p->pos == ',') {
+		p->pos++;
+		skip_space(p);
+	    } else if (*p->pos != close) {
+		die("expected ',' in %s", p->file);
+	    }
+	}
+	p->pos++;
+	return n;
+    }
+
+    case '"':
+	n = jalloc(p, J_STR);
+	n->str = parse_string(p);
+	return n;
+
+    case 't':
+    case 'f':
+    case 'n':
+	if (!strncmp(p->pos, "true", 4) || !strncmp(p->pos, "null", 4)) {
+	    n = jalloc(p, *p->pos == 't' ? J_BOOL : J_NULL);
+	    n->num = *p->pos == 't';
+	    p->pos += 4;
+	    return n;
+	}
+	if (!strncmp(p->pos, "false", 5)) {
+	    n = jalloc(p, J_BOOL);
+	    p->pos += 5;
+	    return n;
+	}
+	die("unexpected literal in %s", p->file);
+	return NULL;
+
+    default: {
+	char *end;
+
+	n = jalloc(p, J_NUM);
+	n->inum = strtoll(p->pos, &end, 10);
+	n->is_int = *end != '.' && *end != 'e' && *end != 'E';
+	n->num = strtod(p->pos, &end);
+	if (end == p->pos)
+	    die("unexpected character in %s", p->file);
+	p->pos = end;
+	return n;
+    }
+    }
+}
+
+static jnode_t *member(const jnode_t *obj, const char *key) {
+    if (obj == NULL || obj->type != J_OBJ)
+	return NULL;
+
+    for (jnode_t *n = obj->child; n != NULL; n = n->next)
+	if (!strcmp(n->key, key))
+	    return n;
+
+    return NULL;
+}
+
+static const char *member_str(const jnode_t *obj, const char *key) {
+    jnode_t *n = member(obj, key);
+    return n != NULL && n->type == J_STR ? n->str : NULL;
+}
+
+static double member_num(const jnode_t *obj, const char *key) {
+    jnode_t *n = member(obj, key);
+    return n != NULL && (n->type == J_NUM || n->type == J_BOOL) ? n->num : 0;
+}
+
+static char *read_file(const char *name) {
+    FILE *fd = fopen(name, "rb");
+    if (fd == NULL) {
+	fprintf(stderr, "ERROR: Unable to open %s: %s\n", name, strerror(errno));
+	exit(2);
+    }
+
+    size_t size = 0, max = 1 << 16;
+    char  *buf  = malloc(max);
+
+    for (;;) {
+	if (buf == NULL)
+	    die("out of memory reading %s", name);
+	size += fread(buf + size, 1, max - size - 1, fd);
+	if (size < max - 1)
+	    break;
+	max *= 2;
+	buf = realloc(buf, max);
+    }
+
+    buf[size] = 0;
+    fclose(fd);
+    return buf;
+}
+
+
+/*** merged timers ***/
+
+/* one value of a timer, kept in the order of the first file */
+typedef struct {
+    char    *name;
+    int64_t  inum;
+    double   num;
+    bool     is_int;
+} field_t;
+
+typedef struct {
+    char         *prefix;
+    char         *name;
+    char         *group;
+    char         *file;
+    field_t      *fields;
+    unsigned int  nfields;
+} mtimer_t;
+
+/* timers by prefix and name, open addressing with linear probing */
+typedef struct {
+    mtimer_t     **slots;
+    mtimer_t     **order;   /* in the order they were first seen */
+    unsigned int   length;
+    unsigned int   count;
+} table_t;
+
+/* garbage collection statistics by level, see dump_gc_levels in timeR.c */
+#define GC_LEVELS 8
+static const char *gc_fields[] = { "collections", "nodes_marked", "nodes_freed", "bytes_freed" };
+#define GC_FIELDS (sizeof(gc_fields) / sizeof(gc_fields[0]))
+
+typedef struct {
+    long long   runs;
+    char       *unit;
+    long        sample_rate;
+    bool        compensated;
+    double      overhead[3];     /* sums, divided by runs on output */
+    double      total_runtime;
+    double      user_time;
+    double      system_time;
+    double      max_resident_memory;
+    long long   forked_children;
+    long long   forked_incomplete;
+    long long   forked_overflow;
+    table_t     bins;
+    table_t     forked;
+    table_t     bcops;
+    long long   gc_levels[GC_LEVELS][GC_FIELDS];
+} profile_t;
+
+static char *xstrdup(const char *s) {
+    if (s == NULL)
+	return NULL;
+
+    char *copy = strdup(s);
+    if (copy == NULL)
+	die("out of memory%s", "");
+    return copy;
+}
+
+static int strcmp_null(const char *a, const char *b) {
+    if (a == NULL || b == NULL)
+	return a == b ? 0 : (a == NULL ? -1 : 1);
+    return strcmp(a, b);
+}
+
+static uint64_t hash_key(const char *prefix, const char *name) {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (const char *c = prefix != NULL ? prefix : ""; *c != 0; c++)
+	h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for (const char *c = name; *c != 0; c++)
+	h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+
+    return h;
+}
+
+static mtimer_t **table_slot(table_t *t, const char *prefix, const char *name) {
+    unsigned int i = hash_key(prefix, name) & (t->length - 1);
+
+    while (t->slots[i] != NULL &&
+	   (strcmp(t->slots[i]->name, name) ||
+	    strcmp_null(t->slots[i]->prefix, prefix)))
+	i = (i + 1) & (t->length - 1);
+
+    return &t->slots[i];
+}
+
+static mtimer_t *table_get(table_t *t, const char *prefix, const char *name) {
+    return t->length != 0 ? *table_slot(t, prefix, name) : NULL;
+}
+
+static mtimer_t *table_add(table_t *t, const char *prefix, const char *name) {
+    /* keep the load below 1/2 */
+    if (2 * (t->count + 1) > t->length) {
+	table_t grown = { NULL, t->order, t->length != 0 ? 2 * t->length : 1024, t->count };
+
+	grown.slots = calloc(grown.length, sizeof(mtimer_t *));
+	grown.order = realloc(t->order, grown.length * sizeof(mtimer_t *));
+	if (grown.slots == NULL || grown.order == NULL)
+	    die("out of memory%s", "");
+
+	for (unsigned int i = 0; i < t->count; i++)
+	    *table_slot(&grown, grown.order[i]->prefix, grown.order[i]->name) = grown.order[i];
+
+	free(t->slots);
+	*t = grown;
+    }
+
+    mtimer_t **slot = table_slot(t, prefix, name);
+    if (*slot == NULL) {
+	*slot = calloc(1, sizeof(mtimer_t));
+	if (*slot == NULL)
+	    die("out of memory%s", "");
+	(*slot)->prefix = xstrdup(prefix);
+	(*slot)->name   = xstrdup(name);
+	t->order[t->count++] = *slot;
+    }
+
+    return *slot;
+}
+
+static field_t *timer_field(mtimer_t *tm, const char *name) {
+    for (unsigned int i = 0; i < tm->nfields; i++)
+	if (!strcmp(tm->fields[i].name, name))
+	    return &tm->fields[i];
+
+    tm->fields = realloc(tm->fields, (tm->nfields + 1) * sizeof(field_t));
+    if (tm->fields == NULL)
+	die("out of memory%s", "");
+
+    field_t *f = &tm->fields[tm->nfields++];
+    memset(f, 0, sizeof(field_t));
+    f->name   = xstrdup(name);
+    f->is_int = true;
+    return f;
+}
+
+static double field_value(const mtimer_t *tm, const char *name) {
+    if (tm != NULL)
+	for (unsigned int i = 0; i < tm->nfields; i++)
+	    if (!strcmp(tm->fields[i].name, name))
+		return tm->fields[i].is_int ? (double)tm->fields[i].inum : tm->fields[i].num;
+
+    return 0;
+}
+
+/* add the values of one JSON timer object: the source line is kept, */
+/* maxima and flags are combined, percentiles of single runs can not  */
+/* be merged and are dropped, everything else is summed up            */
+static void merge_timer(table_t *t, const jnode_t *obj) {
+    const char *name = member_str(obj, "name");
+    if (name == NULL)
+	return;
+
+    mtimer_t *tm = table_add(t, member_str(obj, "prefix"), name);
+    if (tm->group == NULL)
+	tm->group = xstrdup(member_str(obj, "group"));
+    if (tm->file == NULL)
+	tm->file = xstrdup(member_str(obj, "file"));
+
+    for (jnode_t *n = obj->child; n != NULL; n = n->next) {
+	if (n->type != J_NUM ||
+	    !strcmp(n->key, "p50") || !strcmp(n->key, "p90") || !strcmp(n->key, "p99"))
+	    continue;
+
+	unsigned int nfields = tm->nfields;
+	field_t     *f       = timer_field(tm, n->key);
+	bool         fresh   = tm->nfields != nfields;
+
+	if (!n->is_int && f->is_int) {
+	    f->num    = (double)f->inum;
+	    f->is_int = false;
+	}
+
+	if (!strcmp(n->key, "line")) {
+	    if (fresh)
+		f->inum = n->inum;
+	} else if (!strcmp(n->key, "bcode") || !strcmp(n->key, "max")) {
+	    if (n->inum > f->inum)
+		f->inum = n->inum;
+	} else if (f->is_int) {
+	    f->inum += n->inum;
+	} else {
+	    f->num += n->num;
+	}
+    }
+}
+
+static void merge_gc_levels(profile_t *prof, const jnode_t *arr) {
+    if (arr == NULL || arr->type != J_ARR)
+	return;
+
+    for (jnode_t *n = arr->child; n != NULL; n = n->next) {
+	long level = n->type == J_OBJ ? (long)member_num(n, "level") : -1;
+
+	if (level < 0 || level >= GC_LEVELS)
+	    continue;
+	for (unsigned int i = 0; i < GC_FIELDS; i++)
+	    prof->gc_levels[level][i] += (long long)member_num(n, gc_fields[i]);
+    }
+}
+
+static void merge_timers(table_t *t, const jnode_t *arr) {
+    if (arr == NULL || arr->type != J_ARR)
+	return;
+
+    for (jnode_t *n = arr->child; n != NULL; n = n->next)
+	if (n->type == J_OBJ)
+	    merge_timer(t, n);
+}
+
+/* add one output file; the main process nests the files of children */
+/* that did not fit into the shared memory segment in its "children"  */
+/* array, they count as forked and forked_overflow only reports them  */
+static void merge_object(profile_t *prof, const jnode_t *obj,
+			 const char *file, bool child) {
+    const char *unit = member_str(obj, "unit");
+
+    if (strcmp_null(member_str(obj, "format"), "timeR"))
+	die("%s is not a timeR JSON file", file);
+
+    if (prof->unit == NULL) {
+	prof->unit        = xstrdup(unit);
+	prof->sample_rate = (long)member_num(obj, "sample_rate");
+	prof->compensated = member_num(obj, "compensated") != 0;
+    } else if (strcmp_null(prof->unit, unit)) {
+	die("%s uses a different timer unit", file);
+    }
+
+    if ((member_num(obj, "compensated") != 0) != prof->compensated)
+	fprintf(stderr, "WARNING: %s mixes compensated and uncompensated times\n", file);
+
+    if (!child) {
+	jnode_t *runs = member(obj, "runs");
+	jnode_t *ovh  = member(obj, "overhead");
+	double   n    = runs != NULL ? runs->num : 1;
+
+	prof->runs          += (long long)n;
+	prof->overhead[0]   += member_num(ovh, "small")  * n;
+	prof->overhead[1]   += member_num(ovh, "medium") * n;
+	prof->overhead[2]   += member_num(ovh, "deep")   * n;
+	prof->total_runtime += member_num(obj, "total_runtime");
+	prof->user_time     += member_num(obj, "user_time");
+	prof->system_time   += member_num(obj, "system_time");
+	if (member_num(obj, "max_resident_memory") > prof->max_resident_memory)
+	    prof->max_resident_memory = member_num(obj, "max_resident_memory");
+	merge_timers(&prof->bins,  member(obj, "bins"));
+	merge_timers(&prof->bcops, member(obj, "bcops"));
+	merge_gc_levels(prof, member(obj, "gc_levels"));
+    } else {
+	prof->forked_children++;
+	merge_timers(&prof->forked, member(obj, "bins"));
+    }
+
+    prof->forked_children   += (long long)member_num(obj, "forked_children");
+    prof->forked_incomplete += (long long)member_num(obj, "forked_incomplete");
+    prof->forked_overflow   += (long long)member_num(obj, "forked_overflow");
+    merge_timers(&prof->forked, member(obj, "forked"));
+
+    jnode_t *children = member(obj, "children");
+    if (children != NULL && children->type == J_ARR)
+	for (jnode_t *n = children->child; n != NULL; n = n->next)
+	    if (n->type == J_OBJ)
+		merge_object(prof, n, file, true);
+}
+
+static void merge_file(profile_t *prof, const char *file) {
+    jparser_t p = { NULL, file, NULL };
+    char     *buf = read_file(file);
+
+    p.pos = buf;
+    jnode_t *root = parse_value(&p);
+    if (root->type != J_OBJ)
+	die("%s is not a timeR JSON file", file);
+
+    merge_object(prof, root, file, false);
+
+    while (p.chunks != NULL) {
+	jchunk_t *next = p.chunks->next;
+	free(p.chunks);
+	p.chunks = next;
+    }
+    free(buf);
+}
+
+
+/*** output ***/
+
+static void write_string(FILE *fd, const char *str) {
+    if (str == NULL) {
+	fputs("null", fd);
+	return;
+    }
+
+    fputc('"', fd);
+    for (const unsigned char *c = (const unsigned char *)str; *c != 0; c++) {
+	if (*c == '"' || *c == '\\')
+	    fprintf(fd, "\\%c", *c);
+	else if (*c < 0x20)
+	    fprintf(fd, "\\u%04x", *c);
+	else
+	    fputc(*c, fd);
+    }
+    fputc('"', fd);
+}
+
+static void write_timers(FILE *fd, const char *key, const table_t *t, bool bins) {
+    fprintf(fd, ",\n\"%s\": [", key);
+
+    for (unsigned int i = 0; i < t->count; i++) {
+	const mtimer_t *tm = t->order[i];
+
+	fputs(i == 0 ? "\n  {" : ",\n  {", fd);
+	if (bins) {
+	    fputs("\"group\": ", fd);
+	    write_string(fd, tm->group);
+	    fputs(", \"prefix\": ", fd);
+	    write_string(fd, tm->prefix);
+	    fputs(", ", fd);
+	}
+	fputs("\"name\": ", fd);
+	write_string(fd, tm->name);
+	if (bins) {
+	    fputs(", \"file\": ", fd);
+	    write_string(fd, tm->file);
+	}
+
+	for (unsigned int j = 0; j < tm->nfields; j++) {
+	    const field_t *f = &tm->fields[j];
+
+	    if (f->is_int)
+		fprintf(fd, ", \"%s\": %lld", f->name, (long long)f->inum);
+	    else
+		fprintf(fd, ", \"%s\": %f", f->name, f->num);
+	}
+	fputc('}', fd);
+    }
+
+    fprintf(fd, "\n]");
+}
+
+static void write_profile(FILE *fd, const profile_t *prof) {
+    double runs = prof->runs != 0 ? (double)prof->runs : 1;
+
+    fprintf(fd, "{\n\"format\": \"timeR\",\n\"version\": 1,\n\"runs\": %lld,\n\"unit\": ",
+	    prof->runs);
+    write_string(fd, prof->unit);
+    fprintf(fd, ",\n\"sample_rate\": %ld", prof->sample_rate);
+    fprintf(fd, ",\n\"compensated\": %s", prof->compensated ? "true" : "false");
+    fprintf(fd, ",\n\"overhead\": {\"small\": %.3f, \"medium\": %.3f, \"deep\": %.3f}",
+	    prof->overhead[0] / runs, prof->overhead[1] / runs, prof->overhead[2] / runs);
+    fprintf(fd, ",\n\"total_runtime\": %.0f", prof->total_runtime);
+    fprintf(fd, ",\n\"user_time\": %f", prof->user_time);
+    fprintf(fd, ",\n\"system_time\": %f", prof->system_time);
+    fprintf(fd, ",\n\"max_resident_memory\": %.0f", prof->max_resident_memory);
+    write_timers(fd, "bins", &prof->bins, true);
+
+    bool first = true;
+    for (unsigned int i = 0; i < GC_LEVELS; i++) {
+	if (prof->gc_levels[i][0] == 0)
+	    continue;
+	fprintf(fd, "%s\n  {\"level\": %u", first ? ",\n\"gc_levels\": [" : ",", i);
+	for (unsigned int j = 0; j < GC_FIELDS; j++)
+	    fprintf(fd, ", \"%s\": %lld", gc_fields[j], prof->gc_levels[i][j]);
+	fputc('}', fd);
+	first = false;
+    }
+    if (!first)
+	fprintf(fd, "\n]");
+
+    if (prof->bcops.count != 0)
+	write_timers(fd, "bcops", &prof->bcops, false);
+    if (prof->forked_children != 0 || prof->forked.count != 0) {
+	fprintf(fd, ",\n\"forked_children\": %lld", prof->forked_children);
+	fprintf(fd, ",\n\"forked_incomplete\": %lld", prof->forked_incomplete);
+	fprintf(fd, ",\n\"forked_overflow\": %lld", prof->forked_overflow);
+	write_timers(fd, "forked", &prof->forked, true);
+    }
+    fprintf(fd, "\n}\n");
+}
+
+
+/*** comparison ***/
+
+typedef struct {
+    const mtimer_t *base;
+    const mtimer_t *new;
+    double          delta;
+} diffrow_t;
+
+static int compare_delta_desc(const void *a_void, const void *b_void) {
+    double a = fabs(((const diffrow_t *)a_void)->delta);
+    double b = fabs(((const diffrow_t *)b_void)->delta);
+
+    return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+static void print_diffrow(const diffrow_t *row, double base_runs, double new_runs) {
+    const mtimer_t *tm = row->new != NULL ? row->new : row->base;
+
+    if (tm->prefix != NULL)
+	printf("%s:", tm->prefix);
+    printf("%s\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\n", tm->name,
+	   field_value(row->base, "self")  / base_runs,
+	   field_value(row->new,  "self")  / new_runs,
+	   row->delta,
+	   field_value(row->base, "total") / base_runs,
+	   field_value(row->new,  "total") / new_runs,
+	   field_value(row->new,  "total") / new_runs -
+	   field_value(row->base, "total") / base_runs,
+	   field_value(row->base, "calls") / base_runs,
+	   field_value(row->new,  "calls") / new_runs);
+}
+
+static void diff_profiles(const profile_t *base, profile_t *new, long limit) {
+    double       base_runs = base->runs != 0 ? (double)base->runs : 1;
+    double       new_runs  = new->runs  != 0 ? (double)new->runs  : 1;
+    unsigned int count     = 0;
+    diffrow_t   *rows      = malloc((base->bins.count + new->bins.count + 1) * sizeof(diffrow_t));
+
+    if (rows == NULL)
+	die("out of memory%s", "");
+
+    if (strcmp_null(base->unit, new->unit))
+	die("the files use different timer units%s", "");
+
+    /* timers of both files and those only in NEW */
+    for (unsigned int i = 0; i < new->bins.count; i++) {
+	mtimer_t *tm = new->bins.order[i];
+
+	rows[count].new  = tm;
+	rows[count].base = table_get((table_t *)&base->bins, tm->prefix, tm->name);
+	count++;
+    }
+
+    /* timers that disappeared */
+    for (unsigned int i = 0; i < base->bins.count; i++) {
+	mtimer_t *tm = base->bins.order[i];
+
+	if (table_get(&new->bins, tm->prefix, tm->name) == NULL) {
+	    rows[count].new  = NULL;
+	    rows[count].base = tm;
+	    count++;
+	}
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+	rows[i].delta = field_value(rows[i].new,  "self") / new_runs -
+			field_value(rows[i].base, "self") / base_runs;
+
+    qsort(rows, count, sizeof(diffrow_t), compare_delta_desc);
+
+    printf("TimerUnit\t%s\n", base->unit != NULL ? base->unit : "");
+    printf("#!LABEL\tbase\tnew\tdelta\n");
+    printf("TotalRuntime\t%.0f\t%.0f\t%.0f\n",
+	   base->total_runtime / base_runs, new->total_runtime / new_runs,
+	   new->total_runtime / new_runs - base->total_runtime / base_runs);
+    printf("# --- individual timers\tself_base\tself_new\tself_delta\t"
+	   "total_base\ttotal_new\ttotal_delta\tcalls_base\tcalls_new\n");
+
+    for (unsigned int i = 0; i < count && (limit <= 0 || i < limit); i++)
+	print_diffrow(&rows[i], base_runs, new_runs);
+
+    free(rows);
+}
+
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+	    "Usage: %s [-o OUTPUT] FILE...\n"
+	    "       %s -d [-n COUNT] BASE NEW\n"
+	    "Merges timeR output files written with --timeR-json, or lists the\n"
+	    "changes of all timers between two of them (-d).\n", prog, prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    bool        diff   = false;
+    long        limit  = 0;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "do:n:h")) != -1) {
+	switch (opt) {
+	case 'd': diff   = true;                      break;
+	case 'o': output = optarg;                    break;
+	case 'n': limit  = strtol(optarg, NULL, 10);  break;
+	default:  usage(argv[0]);
+	}
+    }
+
+    if (diff) {
+	if (argc - optind != 2)
+	    usage(argv[0]);
+
+	profile_t base = { 0 }, new = { 0 };
+
+	merge_file(&base, argv[optind]);
+	merge_file(&new,  argv[optind + 1]);
+	diff_profiles(&base, &new, limit);
+	return 0;
+    }
+
+    if (argc - optind < 1)
+	usage(argv[0]);
+
+    profile_t prof = { 0 };
+
+    for (int i = optind; i < argc; i++)
+	merge_file(&prof, argv[i]);
+
+    FILE *fd = stdout;
+    if (output != NULL && (fd = fopen(output, "w")) == NULL) {
+	fprintf(stderr, "ERROR: Unable to open %s: %s\n", output, strerror(errno));
+	return 2;
+    }
+
+    write_profile(fd, &prof);
+
+    if (fd != stdout)
+	fclose(fd);
+
+    return 0;
+}
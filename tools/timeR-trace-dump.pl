@@ -0,0 +1,81 @@
+#!/usr/bin/env perl
+#
+# A script to convert a binary trace written by --timeR-trace into
+# text, one event per line: time, depth, start/stop and timer name.
+
+use warnings;
+use strict;
+use feature ':5.10';
+
+if (scalar(@ARGV) != 1) {
+    say STDERR "Usage: $0 trace-file";
+    exit 1;
+}
+
+my $trace_file = shift;
+open IN, "<:raw", $trace_file or die "Can't open $trace_file: $!";
+
+my $buf;
+read(IN, $buf, 80) == 80 or die "$trace_file: short header";
+
+my ($magic, $version, $event_size, $start, $events, $names_offset,
+    $stalls, $unit) = unpack("a8 L L q Q Q Q Z32", $buf);
+
+if ($magic ne "timeRtrc" || $version != 1 || $event_size != 8) {
+    say STDERR "ERROR: $trace_file is not a timeR trace (version 1)";
+    exit 2;
+}
+
+if ($names_offset == 0) {
+    say STDERR "ERROR: $trace_file is incomplete, R did not exit normally";
+    exit 2;
+}
+
+# read the name table
+my @names;
+seek(IN, $names_offset, 0) or die "$trace_file: $!";
+read(IN, $buf, 4) == 4 or die "$trace_file: short name table";
+my $count = unpack("L", $buf);
+
+for (my $i = 0; $i < $count; $i++) {
+    read(IN, $buf, 4) == 4 or die "$trace_file: short name table";
+    my $len = unpack("L", $buf);
+    read(IN, $buf, $len) == $len or die "$trace_file: short name table";
+    push @names, $buf;
+}
+
+say "# unit: $unit, events: $events, stalls: $stalls";
+
+# decode the events
+seek(IN, 4096, 0) or die "$trace_file: $!";
+
+my $time  = 0;
+my $high  = 0;
+my $depth = 0;
+
+for (my $i = 0; $i < $events; $i++) {
+    read(IN, $buf, 8) == 8 or die "$trace_file: short event list";
+    my ($word, $delta) = unpack("L L", $buf);
+    my $type = $word >> 30;
+    my $bin  = $word & 0x3fffffff;
+
+    if ($type == 3) {
+        $high = $delta;
+        next;
+    }
+
+    $time += $high * 2**32 + $delta;
+    $high  = 0;
+
+    my $name = $bin < scalar(@names) ? $names[$bin] : "<unknown $bin>";
+
+    if ($type == 0) {
+        say "$time\t$depth\tstart\t$name";
+        $depth++;
+    } else {
+        $depth-- if $depth > 0;
+        say "$time\t$depth\tstop\t$name";
+    }
+}
+
+close IN;